@@ -0,0 +1,67 @@
+/* Barrier synchronization shared by the pthread solvers. 
+ *
+ * Compile together with the solver, e.g.:
+ * gcc -o solver solver.c solver_gold.c barrier.c ... -O3 -Wall -std=c99 -lm -lpthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include "barrier.h"
+
+/* Initialize the barrier for the given number of threads. */
+void 
+barrier_init (BARRIER *barrier, int num_threads)
+{
+    barrier->counter = 0;
+    barrier->num_threads = num_threads;
+    sem_init (&barrier->counter_sem, 0, 1); /* Initialize the semaphore protecting the counter to 1 */
+    sem_init (&barrier->barrier_sem, 0, 0); /* Initialize the semaphore protecting the barrier to 0 */
+    sem_init (&barrier->exit_sem, 0, 0); /* Initialize the semaphore protecting the barrier exit to 0 */
+}
+
+void 
+barrier_destroy (BARRIER *barrier)
+{
+    sem_destroy (&barrier->counter_sem);
+    sem_destroy (&barrier->barrier_sem);
+    sem_destroy (&barrier->exit_sem);
+}
+
+/* Wait until all threads reach the barrier. The last thread to arrive calls last_thread (arg), 
+ * if given, before any thread is allowed to cross. */
+void 
+barrier_sync (BARRIER *barrier, void (*last_thread) (void *), void *arg)
+{
+    int i;
+
+    sem_wait (&(barrier->counter_sem)); /* Obtain the lock on the counter */
+
+    /* Check if all threads before us, that is NUM_THREADS-1 threads have reached this point */
+    if (barrier->counter == (barrier->num_threads - 1)) {
+        if (last_thread != NULL)
+            last_thread (arg);
+
+        /* Signal the blocked threads that it is now safe to cross the barrier */			 
+        for (i = 0; i < (barrier->num_threads - 1); i++)
+            sem_post (&(barrier->barrier_sem));
+    } 
+    else {
+        barrier->counter++; // Increment the counter
+        sem_post (&(barrier->counter_sem)); // Release the lock on the counter
+        sem_wait (&(barrier->barrier_sem)); // Block on the barrier semaphore and wait for someone to signal us when it is safe to cross
+        sem_wait (&(barrier->counter_sem));
+    }
+
+    /* Second phase: the last thread to leave releases the others. */
+    if (barrier->counter == 0) {
+        sem_post (&(barrier->counter_sem));
+        for (i = 0; i < (barrier->num_threads - 1); i++)
+            sem_post (&(barrier->exit_sem));
+    }
+    else {
+        barrier->counter--;
+        sem_post (&(barrier->counter_sem));
+        sem_wait (&(barrier->exit_sem));
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef __BARRIER__
+#define __BARRIER__
+
+#include <semaphore.h>
+
+/* Reusable counting barrier built from semaphores. The last thread to arrive runs an 
+ * optional function while the others are still blocked, and the barrier has two phases 
+ * so that a fast thread cannot consume a wake-up meant for a thread still leaving it. */
+typedef struct barrier_struct {
+    sem_t counter_sem; /* Protects access to the counter */
+    sem_t barrier_sem; /* Signals that barrier is safe to cross */
+    sem_t exit_sem; /* Signals that all threads have left the barrier */
+    int counter; /* The counter of threads */
+    int num_threads; /* Number of threads that must reach the barrier */
+} BARRIER;
+
+void barrier_init (BARRIER *, int);
+void barrier_destroy (BARRIER *);
+void barrier_sync (BARRIER *, void (*) (void *), void *);
+
+#endif
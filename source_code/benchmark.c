@@ -0,0 +1,600 @@
+/* Benchmark for the decompositions used by the jacobi solvers in this repository, and for the
+ * red-black solvers next to them.
+ *
+ * The jacobi implementations differ in how the interior points are divided among the threads:
+ *
+ *     column-cyclic  solver.c                 thread t updates columns t, t + p, t + 2p, ...
+ *     flat-cyclic    save.c                   every p-th interior point in row-major order
+ *     row-block      save2.c                  a contiguous block of rows per thread
+ *     row-cyclic     project2Jacobi/save.c    thread t updates rows t, t + p, t + 2p, ...
+ *     blocks-2d      solver_blocks.c          a 2-D grid of rectangular blocks
+ *
+ * To compare them fairly, each decomposition is expressed as a sweep function behind a common
+ * interface and run by the same driver: the same double-buffered update, the same two-phase barrier
+ * from barrier.c with the residual reduced by the last thread to arrive, and the same convergence
+ * test. (The original programs also differ in their barriers, some of which can lose wake-ups, and
+ * in how they copy the grid between iterations; those differences are not benchmarked here.)
+ *
+ * Side by side with them, the driver runs the in-place red-black solvers of solver_rb.c as they
+ * are: Gauss-Seidel (rb), SOR with the optimal omega (sor) and SOR with an adapted omega
+ * (sor-adaptive). Their iterations are full sweeps over both colors, so the iteration counts and
+ * times to eps compare directly with those of the jacobi decompositions. The solvers print their
+ * progress on stdout, which is discarded while they run; their barrier wait is not measured and
+ * reported as 0.
+ *
+ * For every combination of grid dimension, thread count and decomposition the driver solves the
+ * same plate and reports the wall time to convergence (gettimeofday), the iteration count, the
+ * lattice updates per second, and the average time a thread spends waiting in the barrier. The
+ * report is printed as CSV (default) or JSON. The dimensions go as high as memory allows, e.g.
+ * -d 256,1024,4096,16384 -s row-block,rb,sor,sor-adaptive.
+ *
+ * With -g the driver instead times the whole-grid kernels of grid_parallel.c that surround every
+ * solve: grid-setup allocates, zeroes and copies a padded grid, grid-teardown computes
+ * its statistics and the MSE against the copy and frees both. Their updates/s are grid points per
+ * second.
+ *
+ * Compile as follows:
+ * gcc -o benchmark benchmark.c barrier.c grid_parallel.c solver_rb.c -O3 -march=native -Wall -std=c99 -lm -lpthread
+ *
+ * Usage: benchmark [-d dims] [-t threads] [-s strategies] [-r repeats] [-g] [-j]
+ * where dims, threads and strategies are comma-separated lists.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+#define MAX_LIST 32
+#define MIN_TEMP 10.0
+#define MAX_TEMP 100.0
+#define SEED 353 /* Every run solves the same plate */
+
+/* Sweep of the points owned by one thread: reads src, writes dst, returns the sum of |new - old|. */
+typedef double (*SWEEP_FN) (const float *, float *, int, int, int);
+
+/* A decomposition of the interior among the threads, or a whole solver */
+typedef struct strategy_t {
+    const char *name;
+    const char *origin; /* Program that uses this decomposition */
+    SWEEP_FN sweep;
+    int (*solve) (grid_t *, int); /* If not NULL, run this solver instead of sweep */
+} STRATEGY;
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_bench_thread_t {
+    int thread_idx;
+    double diff;
+    double wait; /* Seconds spent in the barrier */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_BENCH_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_BENCH_THREAD) == CACHE_LINE, "ARGS_FOR_BENCH_THREAD must fill one cache line");
+
+/* One line of the report */
+typedef struct result_t {
+    const char *strategy;
+    int dim;
+    int num_threads;
+    int iterations;
+    double seconds;
+    double updates_per_second;
+    double barrier_wait; /* Average over the threads, in seconds */
+} RESULT;
+
+/* Function prototypes */
+static double sweep_column_cyclic (const float *, float *, int, int, int);
+static double sweep_flat_cyclic (const float *, float *, int, int, int);
+static double sweep_row_block (const float *, float *, int, int, int);
+static double sweep_row_cyclic (const float *, float *, int, int, int);
+static double sweep_blocks_2d (const float *, float *, int, int, int);
+static double relax_point (const float *, float *, int, int);
+static void run_benchmark (STRATEGY *, int, int, RESULT *);
+static void run_solver_benchmark (STRATEGY *, int, int, RESULT *);
+static void run_grid_benchmark (int, int, RESULT *, RESULT *);
+static void *bench_thread (void *);
+static void end_of_bench_iteration (void *);
+static grid_t *create_plate (int);
+static double wall_time (void);
+static int parse_list (char *, int *);
+static void print_csv (RESULT *, int);
+static void print_json (RESULT *, int);
+
+extern void parallel_zero_grid (grid_t *, int);
+extern void parallel_copy_grid (grid_t *, grid_t *, int);
+extern size_t parallel_grid_stats (grid_t *, int, float *, float *, double *);
+extern double parallel_grid_mse (grid_t *, grid_t *, int);
+extern int compute_using_pthreads_red_black (grid_t *, int);
+extern int compute_using_pthreads_sor (grid_t *, int);
+extern int compute_using_pthreads_sor_adaptive (grid_t *, int);
+
+/* Shared variables */
+float eps = 1e-2; /* Convergence criteria, as in the solvers. */
+static grid_t *bench_grid;
+static grid_t *bench_temp;
+static ARGS_FOR_BENCH_THREAD *bench_args;
+static BARRIER bench_barrier;
+static SWEEP_FN bench_sweep;
+static int bench_num_threads;
+static int bench_iter;
+static int bench_done;
+
+STRATEGY strategies[] = {
+    {"column-cyclic", "solver.c", sweep_column_cyclic, NULL},
+    {"flat-cyclic", "save.c", sweep_flat_cyclic, NULL},
+    {"row-block", "save2.c", sweep_row_block, NULL},
+    {"row-cyclic", "project2Jacobi/save.c", sweep_row_cyclic, NULL},
+    {"blocks-2d", "solver_blocks.c", sweep_blocks_2d, NULL},
+    {"rb", "solver_rb.c, red-black Gauss-Seidel", NULL, compute_using_pthreads_red_black},
+    {"sor", "solver_rb.c, red-black SOR, optimal omega", NULL, compute_using_pthreads_sor},
+    {"sor-adaptive", "solver_rb.c, red-black SOR, adapted omega", NULL, compute_using_pthreads_sor_adaptive},
+    {NULL, NULL, NULL, NULL}
+};
+
+int
+main (int argc, char **argv)
+{
+    int dims[MAX_LIST] = {256, 512, 1024};
+    int threads[MAX_LIST] = {1, 2, 4, 8};
+    int num_dims = 3, num_thread_counts = 4;
+    int selected[MAX_LIST];
+    int num_selected = 0;
+    int repeats = 1;
+    int json = 0;
+    int grid_kernels = 0;
+    int bad_option = 0;
+    int num_strategies, num_results, i, j, k, r, c;
+    char *name;
+    RESULT *results;
+
+    for (num_strategies = 0; strategies[num_strategies].name != NULL; num_strategies++)
+        selected[num_selected++] = num_strategies;
+
+    while ((c = getopt (argc, argv, "d:t:s:r:gj")) != -1) {
+        switch (c) {
+            case 'd':
+                num_dims = parse_list (optarg, dims);
+                break;
+            case 't':
+                num_thread_counts = parse_list (optarg, threads);
+                break;
+            case 's':
+                num_selected = 0;
+                for (name = strtok (optarg, ","); name != NULL; name = strtok (NULL, ",")) {
+                    for (k = 0; k < num_strategies; k++)
+                        if (strcmp (strategies[k].name, name) == 0)
+                            break;
+                    if (k == num_strategies || num_selected == MAX_LIST)
+                        bad_option = 1;
+                    else
+                        selected[num_selected++] = k;
+                }
+                break;
+            case 'r':
+                repeats = atoi (optarg);
+                break;
+            case 'g':
+                grid_kernels = 1;
+                break;
+            case 'j':
+                json = 1;
+                break;
+            default:
+                bad_option = 1;
+        }
+    }
+
+    if (bad_option || num_dims < 1 || num_thread_counts < 1 || num_selected < 1 || repeats < 1) {
+        printf ("Usage: %s [-d dims] [-t threads] [-s strategies] [-r repeats] [-g] [-j]\n", argv[0]);
+        printf ("\t-d dims        Comma-separated grid dimensions (default 256,512,1024)\n");
+        printf ("\t-t threads     Comma-separated thread counts (default 1,2,4,8)\n");
+        printf ("\t-s strategies  Comma-separated decompositions and solvers (default all)\n");
+        printf ("\t-r repeats     Runs per configuration; the fastest is reported (default 1)\n");
+        printf ("\t-g             Time the grid setup and teardown kernels instead of the solvers\n");
+        printf ("\t-j             Print the report as JSON instead of CSV\n");
+        printf ("strategies:\n");
+        for (k = 0; k < num_strategies; k++)
+            printf ("\t%-14s %s\n", strategies[k].name, strategies[k].origin);
+        exit (EXIT_FAILURE);
+    }
+
+    if (grid_kernels)
+        num_selected = 2; /* grid-setup and grid-teardown */
+    results = (RESULT *) malloc (sizeof (RESULT) * num_dims * num_thread_counts * num_selected);
+    num_results = 0;
+    for (i = 0; i < num_dims && grid_kernels; i++) {
+        for (j = 0; j < num_thread_counts; j++) {
+            RESULT *setup = &results[num_results++];
+            RESULT *teardown = &results[num_results++];
+            for (r = 0; r < repeats; r++) {
+                RESULT result_setup, result_teardown;
+                run_grid_benchmark (dims[i], threads[j], &result_setup, &result_teardown);
+                if (r == 0 || result_setup.seconds < setup->seconds)
+                    *setup = result_setup;
+                if (r == 0 || result_teardown.seconds < teardown->seconds)
+                    *teardown = result_teardown;
+            }
+            fprintf (stderr, "grid dim %d threads %d: setup %fs, teardown %fs\n", dims[i], threads[j],
+                     setup->seconds, teardown->seconds);
+        }
+    }
+    for (i = 0; i < num_dims && !grid_kernels; i++) {
+        for (j = 0; j < num_thread_counts; j++) {
+            for (k = 0; k < num_selected; k++) {
+                RESULT *best = &results[num_results++];
+                for (r = 0; r < repeats; r++) {
+                    RESULT result;
+                    if (strategies[selected[k]].solve != NULL)
+                        run_solver_benchmark (&strategies[selected[k]], dims[i], threads[j], &result);
+                    else
+                        run_benchmark (&strategies[selected[k]], dims[i], threads[j], &result);
+                    if (r == 0 || result.seconds < best->seconds)
+                        *best = result;
+                }
+                fprintf (stderr, "%s dim %d threads %d: %d iterations, %fs\n", best->strategy,
+                         best->dim, best->num_threads, best->iterations, best->seconds);
+            }
+        }
+    }
+
+    if (json)
+        print_json (results, num_results);
+    else
+        print_csv (results, num_results);
+
+    free ((void *) results);
+    exit (EXIT_SUCCESS);
+}
+
+/* Solve a fresh plate of the given dimension with one decomposition. */
+static void
+run_benchmark (STRATEGY *strategy, int dim, int num_threads, RESULT *result)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    double start, stop, wait = 0.0;
+    int i;
+
+    bench_grid = create_plate (dim);
+    bench_temp = create_plate (dim); /* Second buffer, swapped with the grid each iteration */
+    bench_sweep = strategy->sweep;
+    bench_num_threads = num_threads;
+    bench_iter = 0;
+    bench_done = 0;
+    barrier_init (&bench_barrier, num_threads);
+
+    if (posix_memalign ((void **) &bench_args, CACHE_LINE, sizeof (ARGS_FOR_BENCH_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    start = wall_time ();
+    for (i = 0; i < num_threads; i++) {
+        bench_args[i].thread_idx = i;
+        bench_args[i].wait = 0.0;
+        if ((pthread_create (&thread_id[i], NULL, bench_thread, (void *) &bench_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+    stop = wall_time ();
+
+    for (i = 0; i < num_threads; i++)
+        wait += bench_args[i].wait;
+
+    result->strategy = strategy->name;
+    result->dim = dim;
+    result->num_threads = num_threads;
+    result->iterations = bench_iter;
+    result->seconds = stop - start;
+    result->updates_per_second = (double) bench_iter * (dim - 2) * (dim - 2)/result->seconds;
+    result->barrier_wait = wait/num_threads;
+
+    barrier_destroy (&bench_barrier);
+    free ((void *) bench_args);
+    free ((void *) bench_grid->element);
+    free ((void *) bench_grid);
+    free ((void *) bench_temp->element);
+    free ((void *) bench_temp);
+    free ((void *) thread_id);
+}
+
+/* Solve a fresh plate of the given dimension with one of the solvers, its progress output discarded. */
+static void
+run_solver_benchmark (STRATEGY *strategy, int dim, int num_threads, RESULT *result)
+{
+    grid_t *grid = create_plate (dim);
+    int saved_stdout, null_fd;
+    double start, stop;
+
+    fflush (stdout);
+    saved_stdout = dup (STDOUT_FILENO);
+    null_fd = open ("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || null_fd < 0) {
+        perror ("open");
+        exit (EXIT_FAILURE);
+    }
+    dup2 (null_fd, STDOUT_FILENO);
+
+    start = wall_time ();
+    result->iterations = strategy->solve (grid, num_threads);
+    stop = wall_time ();
+
+    fflush (stdout);
+    dup2 (saved_stdout, STDOUT_FILENO);
+    close (saved_stdout);
+    close (null_fd);
+
+    result->strategy = strategy->name;
+    result->dim = dim;
+    result->num_threads = num_threads;
+    result->seconds = stop - start;
+    result->updates_per_second = (double) result->iterations * (dim - 2) * (dim - 2)/result->seconds;
+    result->barrier_wait = 0.0;
+
+    free ((void *) grid->element);
+    free ((void *) grid);
+}
+
+/* Time the setup and teardown of a padded dim x dim grid and its copy with the parallel kernels. */
+static void
+run_grid_benchmark (int dim, int num_threads, RESULT *setup, RESULT *teardown)
+{
+    grid_t grid, copy;
+    double start, stop, sum;
+    float min, max;
+    int j;
+
+    grid.dim = grid.nx = grid.ny = dim;
+    grid.nz = 1;
+    grid.stride = (((size_t) dim * sizeof (float) + GRID_ALIGN - 1)/GRID_ALIGN) * (GRID_ALIGN/sizeof (float));
+    grid.plane = grid.stride * dim;
+    copy = grid;
+
+    start = wall_time ();
+    if (posix_memalign ((void **) &grid.element, GRID_ALIGN, sizeof (float) * grid.plane) != 0 ||
+        posix_memalign ((void **) &copy.element, GRID_ALIGN, sizeof (float) * copy.plane) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    parallel_zero_grid (&grid, num_threads);
+    srand (SEED);
+    for (j = 1; j < (dim - 1); j++)
+        grid.element[j] = MIN_TEMP + (MAX_TEMP - MIN_TEMP) * rand ()/(float) RAND_MAX;
+    parallel_copy_grid (&copy, &grid, num_threads);
+    stop = wall_time ();
+    setup->strategy = "grid-setup";
+    setup->seconds = stop - start;
+
+    start = wall_time ();
+    parallel_grid_stats (&grid, num_threads, &min, &max, &sum);
+    parallel_grid_mse (&grid, &copy, num_threads);
+    free ((void *) grid.element);
+    free ((void *) copy.element);
+    stop = wall_time ();
+    teardown->strategy = "grid-teardown";
+    teardown->seconds = stop - start;
+
+    setup->dim = teardown->dim = dim;
+    setup->num_threads = teardown->num_threads = num_threads;
+    setup->iterations = teardown->iterations = 1;
+    setup->updates_per_second = (double) dim * dim/setup->seconds;
+    teardown->updates_per_second = (double) dim * dim/teardown->seconds;
+    setup->barrier_wait = teardown->barrier_wait = 0.0;
+}
+
+/* The function executed by the threads. */
+static void *
+bench_thread (void *thread_parameter)
+{
+    ARGS_FOR_BENCH_THREAD *parameter = (ARGS_FOR_BENCH_THREAD *) thread_parameter;
+    double arrived;
+
+    while (!bench_done) {
+        parameter->diff = bench_sweep (bench_grid->element, bench_temp->element, bench_grid->dim,
+                                       parameter->thread_idx, bench_num_threads);
+
+        arrived = wall_time ();
+        barrier_sync (&bench_barrier, end_of_bench_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+        parameter->wait += wall_time () - arrived;
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence and swaps the two buffers. */
+static void
+end_of_bench_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (bench_grid->dim - 2) * (bench_grid->dim - 2);
+    double diff = 0.0;
+    float *temp;
+    int i;
+
+    for (i = 0; i < bench_num_threads; i++)
+        diff += bench_args[i].diff;
+    diff = diff/num_elements;
+    bench_iter++;
+    if (diff < eps)
+        bench_done = 1;
+
+    temp = bench_grid->element;
+    bench_grid->element = bench_temp->element;
+    bench_temp->element = temp;
+}
+
+/* Update point k and return |new - old|. */
+static inline double
+relax_point (const float *src, float *dst, int dim, int k)
+{
+    float new = 0.25 * (src[k - dim] + src[k + dim] + src[k + 1] + src[k - 1]);
+    dst[k] = new;
+    return fabs (new - src[k]);
+}
+
+/* Columns t + 1, t + 1 + p, ... of every interior row, as in solver.c. */
+static double
+sweep_column_cyclic (const float *src, float *dst, int dim, int t, int p)
+{
+    double diff = 0.0;
+    int i, j;
+
+    for (i = 1; i < (dim - 1); i++)
+        for (j = 1 + t; j < (dim - 1); j += p)
+            diff += relax_point (src, dst, dim, i * dim + j);
+    return diff;
+}
+
+/* Every p-th interior point in row-major order, starting at point t, as in save.c. */
+static double
+sweep_flat_cyclic (const float *src, float *dst, int dim, int t, int p)
+{
+    int n = dim - 2;
+    long num_points = (long) n * n;
+    double diff = 0.0;
+    long m;
+
+    for (m = t; m < num_points; m += p)
+        diff += relax_point (src, dst, dim, (int) (1 + m / n) * dim + (int) (1 + m % n));
+    return diff;
+}
+
+/* A contiguous block of rows, as in save2.c. */
+static double
+sweep_row_block (const float *src, float *dst, int dim, int t, int p)
+{
+    int n = dim - 2;
+    int start = 1 + (t * n)/p;
+    int end = 1 + ((t + 1) * n)/p;
+    double diff = 0.0;
+    int i, j;
+
+    for (i = start; i < end; i++)
+        for (j = 1; j < (dim - 1); j++)
+            diff += relax_point (src, dst, dim, i * dim + j);
+    return diff;
+}
+
+/* Rows t + 1, t + 1 + p, ..., as in project2Jacobi/save.c. */
+static double
+sweep_row_cyclic (const float *src, float *dst, int dim, int t, int p)
+{
+    double diff = 0.0;
+    int i, j;
+
+    for (i = 1 + t; i < (dim - 1); i += p)
+        for (j = 1; j < (dim - 1); j++)
+            diff += relax_point (src, dst, dim, i * dim + j);
+    return diff;
+}
+
+/* One block of a thread_rows x thread_cols grid of blocks, shaped as in solver_blocks.c: the
+ * factorization of p with the smallest total cut length that fits the interior. */
+static double
+sweep_blocks_2d (const float *src, float *dst, int dim, int t, int p)
+{
+    int n = dim - 2;
+    int rows = p, cols = 1;
+    int r, c, i, j;
+    double diff = 0.0;
+
+    for (r = 1; r <= p; r++) {
+        c = p / r;
+        if (p % r == 0 && r <= n && c <= n && r + c < rows + cols) {
+            rows = r;
+            cols = c;
+        }
+    }
+
+    r = t / cols;
+    c = t % cols;
+    for (i = 1 + (r * n)/rows; i < 1 + ((r + 1) * n)/rows; i++)
+        for (j = 1 + (c * n)/cols; j < 1 + ((c + 1) * n)/cols; j++)
+            diff += relax_point (src, dst, dim, i * dim + j);
+    return diff;
+}
+
+/* Create a grid with the same initial conditions as create_grid in solver.c, from a fixed seed. */
+static grid_t *
+create_plate (int dim)
+{
+    grid_t *grid = (grid_t *) malloc (sizeof (grid_t));
+    int j;
+
+    /* Unpadded rows, as in the code the strategies were taken from */
+    grid->dim = grid->nx = grid->ny = dim;
+    grid->nz = 1;
+    grid->stride = dim;
+    grid->plane = (size_t) dim * dim;
+    grid->element = (float *) calloc ((size_t) dim * dim, sizeof (float));
+    if (grid->element == NULL) {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+
+    srand (SEED);
+    for (j = 1; j < (dim - 1); j++)
+        grid->element[j] = MIN_TEMP + (MAX_TEMP - MIN_TEMP) * rand ()/(float) RAND_MAX;
+
+    return grid;
+}
+
+static double
+wall_time (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+/* Parse a comma-separated list of positive integers into list. Returns the number of entries,
+ * or 0 if the list is malformed. */
+static int
+parse_list (char *arg, int *list)
+{
+    int n = 0;
+    char *token;
+
+    for (token = strtok (arg, ","); token != NULL; token = strtok (NULL, ",")) {
+        if (n == MAX_LIST || atoi (token) < 1)
+            return 0;
+        list[n++] = atoi (token);
+    }
+    return n;
+}
+
+static void
+print_csv (RESULT *results, int n)
+{
+    int i;
+
+    printf ("strategy,dim,threads,iterations,seconds,updates_per_second,barrier_wait_seconds\n");
+    for (i = 0; i < n; i++)
+        printf ("%s,%d,%d,%d,%f,%e,%f\n", results[i].strategy, results[i].dim, results[i].num_threads,
+                results[i].iterations, results[i].seconds, results[i].updates_per_second, results[i].barrier_wait);
+}
+
+static void
+print_json (RESULT *results, int n)
+{
+    int i;
+
+    printf ("[\n");
+    for (i = 0; i < n; i++)
+        printf ("  {\"strategy\": \"%s\", \"dim\": %d, \"threads\": %d, \"iterations\": %d, \"seconds\": %f, "
+                "\"updates_per_second\": %e, \"barrier_wait_seconds\": %f}%s\n",
+                results[i].strategy, results[i].dim, results[i].num_threads, results[i].iterations,
+                results[i].seconds, results[i].updates_per_second, results[i].barrier_wait, (i < n - 1) ? "," : "");
+    printf ("]\n");
+}
@@ -0,0 +1,275 @@
+/* Checkpoints of an in-progress solve in a memory-mapped file.
+ *
+ * File layout: the first page holds a file header and one header per slot, followed by two data
+ * slots, each large enough for a dim x dim grid with rows stride floats apart, and aligned to a
+ * page. A checkpoint is taken in three steps:
+ *
+ *     checkpoint_begin returns the data slot of the next checkpoint, which the solver fills with the
+ *         grid (in parallel, while it keeps iterating), or NULL if the previous checkpoint is still
+ *         being flushed, in which case the solver simply skips this one;
+ *     checkpoint_commit hands the filled slot to the flush thread, together with its iteration and
+ *         residual;
+ *     the flush thread writes the slot to disk with msync, then fills in its header (sequence
+ *         number, iteration, residual and a checksum of the data) and writes the header page.
+ *
+ * The iteration loop itself never waits for the disk. The slots alternate, so the last committed
+ * checkpoint is never overwritten. On restart, checkpoint_restore picks the slot with the highest
+ * sequence number whose checksum matches its data, which rejects a slot that was being rewritten
+ * when the process died.
+ *
+ * Compile together with the solver; see the compile line in solver.c.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "JACOBICK"
+#define CHECKPOINT_VERSION 2
+#define SLOT_HEADER_OFFSET 64 /* Slot headers follow the file header, one cache line each */
+
+typedef struct file_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint64_t slot_size;
+} FILE_HEADER;
+
+typedef struct slot_header_s {
+    uint64_t sequence; /* 0 if the slot has never been committed */
+    int64_t iteration;
+    double residual;
+    uint64_t checksum;
+} SLOT_HEADER;
+
+/* Function prototypes */
+static void *flush_thread (void *);
+static SLOT_HEADER *slot_header (CHECKPOINT *, int);
+static float *slot_data (CHECKPOINT *, int);
+static uint64_t slot_checksum (CHECKPOINT *, int, int64_t);
+
+/* Open or create the checkpoint file for a grid of dimension dim with rows stride floats apart, map
+ * it, and start the flush thread. The header of an existing file is read before anything is written:
+ * a checkpoint file of a different dimension, version or layout is an error and is left as it is.
+ * Only a new file, or one without the checkpoint magic, is sized and initialized. */
+void
+checkpoint_open (CHECKPOINT *checkpoint, const char *path, int dim, size_t stride)
+{
+    size_t page = (size_t) sysconf (_SC_PAGESIZE);
+    size_t grid_bytes = sizeof (float) * stride * dim;
+    FILE_HEADER existing, *header;
+    struct stat st;
+    int valid;
+    int s;
+
+    checkpoint->dim = dim;
+    checkpoint->stride = stride;
+    checkpoint->slot_size = ((grid_bytes + page - 1)/page) * page;
+    checkpoint->map_size = page + 2 * checkpoint->slot_size;
+
+    checkpoint->fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (checkpoint->fd < 0 || fstat (checkpoint->fd, &st) < 0) {
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+
+    valid = (pread (checkpoint->fd, &existing, sizeof (existing), 0) == (ssize_t) sizeof (existing) &&
+             memcmp (existing.magic, CHECKPOINT_MAGIC, sizeof (existing.magic)) == 0);
+    if (valid) {
+        if (existing.dim != (uint32_t) dim) {
+            fprintf (stderr, "%s: checkpoint of a %u x %u grid\n", path, existing.dim, existing.dim);
+            exit (EXIT_FAILURE);
+        }
+        if (existing.version != CHECKPOINT_VERSION || existing.slot_size != checkpoint->slot_size ||
+            (size_t) st.st_size != checkpoint->map_size) {
+            fprintf (stderr, "%s: checkpoint of version %u with %llu-byte slots, expected version %d with %zu-byte slots\n",
+                     path, existing.version, (unsigned long long) existing.slot_size, CHECKPOINT_VERSION, checkpoint->slot_size);
+            exit (EXIT_FAILURE);
+        }
+    }
+    else if (ftruncate (checkpoint->fd, 0) < 0 || ftruncate (checkpoint->fd, checkpoint->map_size) < 0) {
+        perror ("ftruncate"); /* New file: sized with zeros, so both slots start out empty */
+        exit (EXIT_FAILURE);
+    }
+
+    checkpoint->map = (char *) mmap (NULL, checkpoint->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->fd, 0);
+    if (checkpoint->map == MAP_FAILED) {
+        perror ("mmap");
+        exit (EXIT_FAILURE);
+    }
+
+    if (!valid) {
+        header = (FILE_HEADER *) checkpoint->map;
+        memcpy (header->magic, CHECKPOINT_MAGIC, sizeof (header->magic));
+        header->version = CHECKPOINT_VERSION;
+        header->dim = dim;
+        header->slot_size = checkpoint->slot_size;
+        msync (checkpoint->map, page, MS_SYNC);
+    }
+
+    /* Continue after the latest committed slot. */
+    checkpoint->sequence = 0;
+    checkpoint->next_slot = 0;
+    for (s = 0; s < 2; s++) {
+        if (slot_header (checkpoint, s)->sequence > checkpoint->sequence) {
+            checkpoint->sequence = slot_header (checkpoint, s)->sequence;
+            checkpoint->next_slot = 1 - s;
+        }
+    }
+
+    checkpoint->pending = 0;
+    checkpoint->shutdown = 0;
+    pthread_mutex_init (&checkpoint->mutex, NULL);
+    pthread_cond_init (&checkpoint->cond, NULL);
+    if ((pthread_create (&checkpoint->flush_thread, NULL, flush_thread, (void *) checkpoint)) != 0) {
+        perror ("pthread_create");
+        exit (EXIT_FAILURE);
+    }
+}
+
+/* Copy the latest valid checkpoint into element, a dim x dim grid with rows stride floats apart. Returns 0 on success and -1
+ * if the file holds no valid checkpoint. */
+int
+checkpoint_restore (CHECKPOINT *checkpoint, float *element, int *iteration, double *residual)
+{
+    int best = -1;
+    int s;
+
+    for (s = 0; s < 2; s++) {
+        SLOT_HEADER *header = slot_header (checkpoint, s);
+        if (header->sequence == 0 || header->checksum != slot_checksum (checkpoint, s, header->iteration))
+            continue;
+        if (best < 0 || header->sequence > slot_header (checkpoint, best)->sequence)
+            best = s;
+    }
+    if (best < 0)
+        return -1;
+
+    memcpy (element, slot_data (checkpoint, best), sizeof (float) * checkpoint->stride * checkpoint->dim);
+    *iteration = (int) slot_header (checkpoint, best)->iteration;
+    *residual = slot_header (checkpoint, best)->residual;
+    checkpoint->next_slot = 1 - best; /* Keep the checkpoint we resumed from */
+    return 0;
+}
+
+/* Returns the data slot to fill for the next checkpoint, or NULL if the flush thread is still busy
+ * with the previous one. */
+float *
+checkpoint_begin (CHECKPOINT *checkpoint)
+{
+    float *data = NULL;
+
+    pthread_mutex_lock (&checkpoint->mutex);
+    if (!checkpoint->pending)
+        data = slot_data (checkpoint, checkpoint->next_slot);
+    pthread_mutex_unlock (&checkpoint->mutex);
+
+    return data;
+}
+
+/* Hand the slot returned by checkpoint_begin, now filled, to the flush thread. */
+void
+checkpoint_commit (CHECKPOINT *checkpoint, int iteration, double residual)
+{
+    pthread_mutex_lock (&checkpoint->mutex);
+    checkpoint->iteration = iteration;
+    checkpoint->residual = residual;
+    checkpoint->pending = 1;
+    pthread_cond_signal (&checkpoint->cond);
+    pthread_mutex_unlock (&checkpoint->mutex);
+}
+
+/* Wait for a pending checkpoint to be written, stop the flush thread, and unmap the file. */
+void
+checkpoint_close (CHECKPOINT *checkpoint)
+{
+    pthread_mutex_lock (&checkpoint->mutex);
+    checkpoint->shutdown = 1;
+    pthread_cond_signal (&checkpoint->cond);
+    pthread_mutex_unlock (&checkpoint->mutex);
+    pthread_join (checkpoint->flush_thread, NULL);
+
+    pthread_mutex_destroy (&checkpoint->mutex);
+    pthread_cond_destroy (&checkpoint->cond);
+    munmap (checkpoint->map, checkpoint->map_size);
+    close (checkpoint->fd);
+}
+
+/* The function executed by the flush thread: writes each committed slot to disk, then its header. */
+static void *
+flush_thread (void *arg)
+{
+    CHECKPOINT *checkpoint = (CHECKPOINT *) arg;
+    size_t page = (size_t) sysconf (_SC_PAGESIZE);
+
+    for (;;) {
+        int slot, iteration;
+        double residual;
+        SLOT_HEADER *header;
+
+        pthread_mutex_lock (&checkpoint->mutex);
+        while (!checkpoint->pending && !checkpoint->shutdown)
+            pthread_cond_wait (&checkpoint->cond, &checkpoint->mutex);
+        if (!checkpoint->pending) {
+            pthread_mutex_unlock (&checkpoint->mutex);
+            break;
+        }
+        slot = checkpoint->next_slot;
+        iteration = checkpoint->iteration;
+        residual = checkpoint->residual;
+        pthread_mutex_unlock (&checkpoint->mutex);
+
+        /* The data must be on disk before the header that vouches for it. */
+        if (msync (slot_data (checkpoint, slot), checkpoint->slot_size, MS_SYNC) < 0)
+            perror ("msync");
+        header = slot_header (checkpoint, slot);
+        header->iteration = iteration;
+        header->residual = residual;
+        header->checksum = slot_checksum (checkpoint, slot, iteration);
+        header->sequence = checkpoint->sequence + 1;
+        if (msync (checkpoint->map, page, MS_SYNC) < 0)
+            perror ("msync");
+
+        pthread_mutex_lock (&checkpoint->mutex);
+        checkpoint->sequence++;
+        checkpoint->next_slot = 1 - slot;
+        checkpoint->pending = 0;
+        pthread_mutex_unlock (&checkpoint->mutex);
+    }
+
+    pthread_exit (NULL);
+}
+
+static SLOT_HEADER *
+slot_header (CHECKPOINT *checkpoint, int slot)
+{
+    return (SLOT_HEADER *) (checkpoint->map + SLOT_HEADER_OFFSET * (slot + 1));
+}
+
+static float *
+slot_data (CHECKPOINT *checkpoint, int slot)
+{
+    return (float *) (checkpoint->map + (checkpoint->map_size - 2 * checkpoint->slot_size) + slot * checkpoint->slot_size);
+}
+
+/* FNV-1a over the 32-bit words of a slot, seeded with the iteration. */
+static uint64_t
+slot_checksum (CHECKPOINT *checkpoint, int slot, int64_t iteration)
+{
+    const uint32_t *word = (const uint32_t *) slot_data (checkpoint, slot);
+    size_t n = checkpoint->stride * checkpoint->dim;
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t) iteration;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        hash = (hash ^ word[i]) * 1099511628211ULL;
+    return hash;
+}
@@ -0,0 +1,35 @@
+#ifndef __CHECKPOINT__
+#define __CHECKPOINT__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Checkpoint file mapped into memory. The file holds two slots, each a complete copy of the grid,
+ * so that a crash while one slot is being written always leaves the other one intact. A background
+ * thread flushes a filled slot to disk and then commits it by writing its header. */
+typedef struct checkpoint_s {
+    int fd;
+    int dim;
+    size_t stride; /* Floats from one row of the grid to the next */
+    char *map; /* Mapping of the whole file */
+    size_t map_size;
+    size_t slot_size; /* Bytes per data slot, a multiple of the page size */
+    uint64_t sequence; /* Sequence number of the latest committed slot */
+    int next_slot; /* Slot that the next checkpoint goes to */
+    int pending; /* A filled slot is waiting for, or being written by, the flush thread */
+    int iteration; /* Iteration and residual of the pending slot */
+    double residual;
+    int shutdown;
+    pthread_t flush_thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} CHECKPOINT;
+
+void checkpoint_open (CHECKPOINT *, const char *, int, size_t);
+int checkpoint_restore (CHECKPOINT *, float *, int *, double *);
+float *checkpoint_begin (CHECKPOINT *);
+void checkpoint_commit (CHECKPOINT *, int, double);
+void checkpoint_close (CHECKPOINT *);
+
+#endif
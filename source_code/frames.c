@@ -0,0 +1,202 @@
+/* Frame file for the transient solver.
+ *
+ * File layout, all values in host byte order:
+ *
+ *     header    "HEATFRM1", uint32 dim, uint32 compressed, double dt
+ *     frames    int32 step, uint32 size, then size bytes: the dim x dim grid as floats, row by
+ *               row, or that block compressed with zlib if compressed is set
+ *
+ * A frame is handed over in two steps. frame_writer_begin returns the buffer for the next frame,
+ * waiting only if both buffers are still queued; the solver fills it, in parallel, and passes it
+ * to the writer thread with frame_writer_commit. The writer thread writes the frames in order.
+ *
+ * Compression needs zlib: compile with -D HAVE_ZLIB and link with -lz. Without it, requesting
+ * compression is an error.
+ *
+ * Compile together with the solver; see the compile line in solver.c.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "frames.h"
+
+#define FRAME_MAGIC "HEATFRM1"
+
+/* Function prototypes */
+static void *writer_thread (void *);
+static void write_bytes (FRAME_WRITER *, const void *, size_t);
+
+/* Create the frame file for dim x dim grids advanced by dt per step, and start the writer thread. */
+void
+frame_writer_open (FRAME_WRITER *writer, const char *path, int dim, double dt, int compress)
+{
+    uint32_t header[2] = {(uint32_t) dim, (uint32_t) compress};
+    int b;
+
+#ifndef HAVE_ZLIB
+    if (compress) {
+        fprintf (stderr, "Compressed frames need zlib: compile with -D HAVE_ZLIB and -lz\n");
+        exit (EXIT_FAILURE);
+    }
+#endif
+    writer->file = fopen (path, "wb");
+    if (writer->file == NULL) {
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    writer->dim = dim;
+    writer->compress = compress;
+    for (b = 0; b < 2; b++) {
+        writer->buffer[b] = (float *) malloc (sizeof (float) * (size_t) dim * dim);
+        if (writer->buffer[b] == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+        writer->full[b] = 0;
+    }
+    writer->next = 0;
+    writer->frames = 0;
+    writer->stalls = 0;
+    writer->bytes = 0;
+    writer->shutdown = 0;
+
+    write_bytes (writer, FRAME_MAGIC, 8);
+    write_bytes (writer, header, sizeof (header));
+    write_bytes (writer, &dt, sizeof (dt));
+
+    pthread_mutex_init (&writer->mutex, NULL);
+    pthread_cond_init (&writer->cond, NULL);
+    if ((pthread_create (&writer->thread, NULL, writer_thread, (void *) writer)) != 0) {
+        perror ("pthread_create");
+        exit (EXIT_FAILURE);
+    }
+}
+
+/* Returns the buffer to fill with the next frame, after waiting for the writer if both buffers are
+ * queued. */
+float *
+frame_writer_begin (FRAME_WRITER *writer)
+{
+    float *buffer;
+
+    pthread_mutex_lock (&writer->mutex);
+    if (writer->full[writer->next])
+        writer->stalls++;
+    while (writer->full[writer->next])
+        pthread_cond_wait (&writer->cond, &writer->mutex);
+    buffer = writer->buffer[writer->next];
+    pthread_mutex_unlock (&writer->mutex);
+
+    return buffer;
+}
+
+/* Queue the buffer returned by frame_writer_begin, now filled with the grid after the given step. */
+void
+frame_writer_commit (FRAME_WRITER *writer, int step)
+{
+    pthread_mutex_lock (&writer->mutex);
+    writer->step[writer->next] = step;
+    writer->full[writer->next] = 1;
+    writer->next = 1 - writer->next;
+    pthread_cond_broadcast (&writer->cond);
+    pthread_mutex_unlock (&writer->mutex);
+}
+
+/* Write the queued frames, stop the writer thread, and close the file. */
+void
+frame_writer_close (FRAME_WRITER *writer)
+{
+    pthread_mutex_lock (&writer->mutex);
+    writer->shutdown = 1;
+    pthread_cond_broadcast (&writer->cond);
+    pthread_mutex_unlock (&writer->mutex);
+    pthread_join (writer->thread, NULL);
+
+    pthread_mutex_destroy (&writer->mutex);
+    pthread_cond_destroy (&writer->cond);
+    free ((void *) writer->buffer[0]);
+    free ((void *) writer->buffer[1]);
+    if (fclose (writer->file) != 0)
+        perror ("fclose");
+}
+
+/* The function executed by the writer thread: writes the queued frames in the order they were
+ * committed. */
+static void *
+writer_thread (void *arg)
+{
+    FRAME_WRITER *writer = (FRAME_WRITER *) arg;
+    size_t raw_size = sizeof (float) * (size_t) writer->dim * writer->dim;
+    unsigned char *packed = NULL; /* Compressed frame */
+    int b = 0; /* Buffer of the next frame to write */
+
+#ifdef HAVE_ZLIB
+    uLongf packed_capacity = compressBound (raw_size);
+    if (writer->compress) {
+        packed = (unsigned char *) malloc (packed_capacity);
+        if (packed == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+    }
+#endif
+
+    for (;;) {
+        int32_t step;
+        uint32_t size = (uint32_t) raw_size;
+        const void *data = writer->buffer[b];
+
+        pthread_mutex_lock (&writer->mutex);
+        while (!writer->full[b] && !writer->shutdown)
+            pthread_cond_wait (&writer->cond, &writer->mutex);
+        if (!writer->full[b]) {
+            pthread_mutex_unlock (&writer->mutex);
+            break;
+        }
+        step = writer->step[b];
+        pthread_mutex_unlock (&writer->mutex);
+
+#ifdef HAVE_ZLIB
+        if (writer->compress) {
+            uLongf packed_size = packed_capacity;
+            if (compress2 (packed, &packed_size, (const Bytef *) writer->buffer[b], raw_size, Z_BEST_SPEED) != Z_OK) {
+                fprintf (stderr, "compress2 failed\n");
+                exit (EXIT_FAILURE);
+            }
+            size = (uint32_t) packed_size;
+            data = packed;
+        }
+#endif
+        write_bytes (writer, &step, sizeof (step));
+        write_bytes (writer, &size, sizeof (size));
+        write_bytes (writer, data, size);
+
+        pthread_mutex_lock (&writer->mutex);
+        writer->frames++;
+        writer->full[b] = 0;
+        pthread_cond_broadcast (&writer->cond);
+        pthread_mutex_unlock (&writer->mutex);
+        b = 1 - b;
+    }
+
+    free ((void *) packed);
+    pthread_exit (NULL);
+}
+
+static void
+write_bytes (FRAME_WRITER *writer, const void *data, size_t size)
+{
+    if (fwrite (data, 1, size, writer->file) != size) {
+        perror ("fwrite");
+        exit (EXIT_FAILURE);
+    }
+    writer->bytes += size;
+}
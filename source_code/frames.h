@@ -0,0 +1,32 @@
+#ifndef __FRAMES__
+#define __FRAMES__
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* Stream of grid frames written to a file by a background thread. Frames pass through two
+ * buffers: the solver fills one while the writer thread writes the other, so the solver only
+ * waits when the writer is more than one frame behind. */
+typedef struct frame_writer_s {
+    FILE *file;
+    int dim;
+    int compress; /* Compress each frame with zlib */
+    float *buffer[2]; /* dim x dim floats each, unpadded */
+    int full[2]; /* The buffer holds a frame for the writer */
+    int step[2]; /* Time step of the frame in each buffer */
+    int next; /* Buffer that the next frame goes to */
+    int frames; /* Frames written */
+    int stalls; /* Times frame_writer_begin had to wait for a buffer */
+    size_t bytes; /* Bytes written, headers included */
+    int shutdown;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} FRAME_WRITER;
+
+void frame_writer_open (FRAME_WRITER *, const char *, int, double, int);
+float *frame_writer_begin (FRAME_WRITER *);
+void frame_writer_commit (FRAME_WRITER *, int);
+void frame_writer_close (FRAME_WRITER *);
+
+#endif
@@ -1,9 +1,27 @@
 #ifndef __GRID__
 #define __GRID__
 
+#include <stddef.h>
+
+#define GRID_ALIGN 64 /* Rows start on a cache line, which is also a full AVX-512 vector */
+
+/* A 2-D (nz == 1) or 3-D grid. Point (k, i, j), in plane k, row i and column j, is stored at
+ * element[k * plane + i * stride + j]. Rows are padded to a multiple of GRID_ALIGN bytes and the
+ * allocation is aligned to GRID_ALIGN, so every row and plane starts on a cache line. Offsets are
+ * size_t, so grids may hold more than 2^31 points. The outermost layer of points on every side
+ * is the fixed boundary. */
 typedef struct grid_s {
-	int dim;  /* Dimension of the grid. */
+	int dim;  /* Dimension of a square 2-D grid; 0 for other shapes. */
+	int nx, ny, nz; /* Points per row, rows per plane, planes */
+	size_t stride; /* Floats from one row to the next, nx rounded up to GRID_ALIGN bytes */
+	size_t plane; /* Floats from one plane to the next, ny * stride */
 	float *element;
 } grid_t;
 
+/* Offset of point (k, i, j) */
+#define GRID_INDEX(grid, k, i, j) ((size_t) (k) * (grid)->plane + (size_t) (i) * (grid)->stride + (size_t) (j))
+
+/* Number of interior points; a 2-D grid has a single plane, which is interior. */
+#define GRID_INTERIOR(grid) ((size_t) ((grid)->nx - 2) * ((grid)->ny - 2) * (((grid)->nz > 1) ? (grid)->nz - 2 : 1))
+
 #endif
@@ -0,0 +1,365 @@
+/* Parallel kernels for whole-grid operations: zeroing a new grid, copying a grid, the statistics
+ * of the interior, and the mean squared error between two grids.
+ *
+ * The rows of the grid, counted across the planes, are divided into num_threads contiguous blocks,
+ * and each block is handled by one thread, the calling thread taking the first. The other blocks go
+ * to a team of threads that is created on first use, grown when a call asks for more threads, and
+ * parked on a condition variable between calls, so a call costs a wakeup rather than a thread
+ * creation. The threads are not pinned, so the split only spreads the work: it says nothing about
+ * which NUMA node a page of a new grid ends up on, or whether that is near the threads that later
+ * solve it. Grids below GRID_PARALLEL_MIN floats are handled by the calling thread alone, where
+ * waking the team would cost more than it saves.
+ *
+ * The copy is one memcpy per block, padding included. The reductions use AVX-512 or AVX2 row
+ * kernels, accumulating the sums in double precision as the SIMD jacobi kernel does; without either
+ * instruction set they fall back to scalar loops.
+ *
+ * Compile together with the solver; see the compile line in solver.c.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#if defined (__AVX512F__) || defined (__AVX2__)
+#include <immintrin.h>
+#endif
+#include "grid.h"
+
+#define CACHE_LINE 64
+#ifndef GRID_PARALLEL_MIN
+#define GRID_PARALLEL_MIN (1 << 20) /* Floats, 4 MB */
+#endif
+
+#define GRID_ZERO 0
+#define GRID_COPY 1
+#define GRID_STATS 2
+#define GRID_MSE 3
+
+/* Work and partial results of one thread, aligned to a cache line */
+typedef struct grid_task_s {
+    grid_t *a, *b; /* Operands: b is the destination of a copy, a the source */
+    double sum;
+    float min, max;
+    int op;
+    int first, last; /* Rows [first, last), counting across planes */
+} __attribute__ ((aligned (CACHE_LINE))) GRID_TASK;
+
+_Static_assert (sizeof (GRID_TASK) == CACHE_LINE, "GRID_TASK must fill one cache line");
+
+/* The team. Thread t, from 1 to team_size - 1, runs task t of every call that has more than t tasks. */
+static int team_size = 1; /* Counting the calling thread */
+static pthread_mutex_t team_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t team_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t team_done = PTHREAD_COND_INITIALIZER;
+static int team_generation; /* Calls started */
+static int team_grown_generation; /* Calls started when the team last grew, where new threads start counting */
+static int team_finished; /* Team threads done with the current call */
+static GRID_TASK *team_tasks;
+static int team_num_tasks;
+
+/* Function prototypes */
+void parallel_zero_grid (grid_t *, int);
+void parallel_copy_grid (grid_t *, grid_t *, int);
+size_t parallel_grid_stats (grid_t *, int, float *, float *, double *);
+double parallel_grid_mse (grid_t *, grid_t *, int);
+static void run_tasks (grid_t *, grid_t *, int, int, GRID_TASK **, int *);
+static void grow_team (int);
+static void *team_thread (void *);
+static void *grid_thread (void *);
+static void row_stats (const float *, int, float *, float *, double *);
+static double row_squared_error (const float *, const float *, int);
+
+/* Write zeros over all of grid, padding included. */
+void
+parallel_zero_grid (grid_t *grid, int num_threads)
+{
+    GRID_TASK *tasks;
+    int num_tasks;
+
+    run_tasks (grid, grid, GRID_ZERO, num_threads, &tasks, &num_tasks);
+    free ((void *) tasks);
+}
+
+/* Copy src into dst, which has the same layout. */
+void
+parallel_copy_grid (grid_t *dst, grid_t *src, int num_threads)
+{
+    GRID_TASK *tasks;
+    int num_tasks;
+
+    run_tasks (src, dst, GRID_COPY, num_threads, &tasks, &num_tasks);
+    free ((void *) tasks);
+}
+
+/* Minimum, maximum and sum of the interior points of grid. Returns the number of interior points. */
+size_t
+parallel_grid_stats (grid_t *grid, int num_threads, float *min, float *max, double *sum)
+{
+    GRID_TASK *tasks;
+    int num_tasks, t;
+
+    run_tasks (grid, grid, GRID_STATS, num_threads, &tasks, &num_tasks);
+    *min = INFINITY;
+    *max = 0.0;
+    *sum = 0.0;
+    for (t = 0; t < num_tasks; t++) {
+        if (tasks[t].min < *min)
+            *min = tasks[t].min;
+        if (tasks[t].max > *max)
+            *max = tasks[t].max;
+        *sum += tasks[t].sum;
+    }
+    free ((void *) tasks);
+
+    return GRID_INTERIOR (grid);
+}
+
+/* Mean squared error between all the points, boundary included, of two grids of the same shape. */
+double
+parallel_grid_mse (grid_t *grid_1, grid_t *grid_2, int num_threads)
+{
+    GRID_TASK *tasks;
+    int num_tasks, t;
+    double sum = 0.0;
+
+    run_tasks (grid_1, grid_2, GRID_MSE, num_threads, &tasks, &num_tasks);
+    for (t = 0; t < num_tasks; t++)
+        sum += tasks[t].sum;
+    free ((void *) tasks);
+
+    return sum/((size_t) grid_1->nx * grid_1->ny * grid_1->nz);
+}
+
+/* Divide the rows of a among the threads, run op on every block, and return the tasks with their
+ * partial results. */
+static void
+run_tasks (grid_t *a, grid_t *b, int op, int num_threads, GRID_TASK **tasks_out, int *num_tasks_out)
+{
+    int num_rows = a->ny * a->nz;
+    int num_tasks = (num_threads < 1 || a->plane * a->nz < GRID_PARALLEL_MIN) ? 1 : num_threads;
+    GRID_TASK *tasks;
+    int t;
+
+    if (num_tasks > num_rows)
+        num_tasks = num_rows;
+    if (posix_memalign ((void **) &tasks, CACHE_LINE, sizeof (GRID_TASK) * num_tasks) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (t = 0; t < num_tasks; t++) {
+        tasks[t].a = a;
+        tasks[t].b = b;
+        tasks[t].op = op;
+        tasks[t].first = ((long) t * num_rows)/num_tasks;
+        tasks[t].last = ((long) (t + 1) * num_rows)/num_tasks;
+    }
+
+    if (num_tasks > 1) {
+        grow_team (num_tasks);
+        pthread_mutex_lock (&team_mutex);
+        team_tasks = tasks;
+        team_num_tasks = num_tasks;
+        team_finished = 0;
+        team_generation++;
+        pthread_cond_broadcast (&team_start);
+        pthread_mutex_unlock (&team_mutex);
+    }
+    grid_thread ((void *) &tasks[0]);
+    if (num_tasks > 1) {
+        pthread_mutex_lock (&team_mutex);
+        while (team_finished < team_size - 1)
+            pthread_cond_wait (&team_done, &team_mutex);
+        pthread_mutex_unlock (&team_mutex);
+    }
+
+    *tasks_out = tasks;
+    *num_tasks_out = num_tasks;
+}
+
+/* Create team threads until the team has size threads, counting the calling thread. Called between
+ * calls, while the team is parked. */
+static void
+grow_team (int size)
+{
+    pthread_t thread_id;
+
+    pthread_mutex_lock (&team_mutex);
+    team_grown_generation = team_generation;
+    for (; team_size < size; team_size++) {
+        if ((pthread_create (&thread_id, NULL, team_thread, (void *) (long) team_size)) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+        pthread_detach (thread_id);
+    }
+    pthread_mutex_unlock (&team_mutex);
+}
+
+/* The function executed by the team threads: wait for a call, run this thread's task if the call
+ * has one, and report back. The threads live until the process exits. */
+static void *
+team_thread (void *arg)
+{
+    int t = (int) (long) arg;
+    int generation;
+
+    pthread_mutex_lock (&team_mutex);
+    generation = team_grown_generation; /* The first call may have started before this thread ran */
+    for (;;) {
+        while (team_generation == generation)
+            pthread_cond_wait (&team_start, &team_mutex);
+        generation = team_generation;
+        if (t < team_num_tasks) {
+            GRID_TASK *task = &team_tasks[t];
+            pthread_mutex_unlock (&team_mutex);
+            grid_thread ((void *) task);
+            pthread_mutex_lock (&team_mutex);
+        }
+        if (++team_finished == team_size - 1)
+            pthread_cond_signal (&team_done);
+    }
+
+    return NULL;
+}
+
+/* The function executed by the threads, and by the calling thread for the first block. */
+static void *
+grid_thread (void *arg)
+{
+    GRID_TASK *task = (GRID_TASK *) arg;
+    grid_t *a = task->a, *b = task->b;
+    size_t offset = task->first * a->stride;
+    size_t count = (task->last - task->first) * a->stride;
+    int k_first = (a->nz == 1) ? 0 : 1;
+    int k_last = (a->nz == 1) ? 1 : a->nz - 1;
+    int r;
+
+    task->min = INFINITY;
+    task->max = 0.0;
+    task->sum = 0.0;
+
+    switch (task->op) {
+        case GRID_ZERO:
+            memset (&a->element[offset], 0, sizeof (float) * count);
+            break;
+        case GRID_COPY:
+            memcpy (&b->element[offset], &a->element[offset], sizeof (float) * count);
+            break;
+        case GRID_STATS:
+            for (r = task->first; r < task->last; r++) {
+                int k = r / a->ny, i = r % a->ny;
+                if (k < k_first || k >= k_last || i == 0 || i == a->ny - 1)
+                    continue; /* Boundary row or plane */
+                row_stats (&a->element[GRID_INDEX (a, k, i, 1)], a->nx - 2, &task->min, &task->max, &task->sum);
+            }
+            break;
+        case GRID_MSE:
+            for (r = task->first; r < task->last; r++)
+                task->sum += row_squared_error (&a->element[r * a->stride], &b->element[r * b->stride], a->nx);
+            break;
+    }
+
+    return NULL;
+}
+
+/* Fold the n points of row into the running minimum, maximum and sum. */
+static void
+row_stats (const float *row, int n, float *min, float *max, double *sum)
+{
+    float lo = *min, hi = *max;
+    double total = 0.0;
+    int j = 0;
+
+#if defined (__AVX512F__)
+    __m512 vmin = _mm512_set1_ps (lo);
+    __m512 vmax = _mm512_set1_ps (hi);
+    __m512d acc_lo = _mm512_setzero_pd ();
+    __m512d acc_hi = _mm512_setzero_pd ();
+
+    for (; j + 16 <= n; j += 16) {
+        __m512 v = _mm512_loadu_ps (&row[j]);
+        vmin = _mm512_min_ps (vmin, v);
+        vmax = _mm512_max_ps (vmax, v);
+        acc_lo = _mm512_add_pd (acc_lo, _mm512_cvtps_pd (_mm512_castps512_ps256 (v)));
+        acc_hi = _mm512_add_pd (acc_hi, _mm512_cvtps_pd (_mm256_castpd_ps (_mm512_extractf64x4_pd (_mm512_castps_pd (v), 1))));
+    }
+    lo = _mm512_reduce_min_ps (vmin);
+    hi = _mm512_reduce_max_ps (vmax);
+    total = _mm512_reduce_add_pd (_mm512_add_pd (acc_lo, acc_hi));
+#elif defined (__AVX2__)
+    __m256 vmin = _mm256_set1_ps (lo);
+    __m256 vmax = _mm256_set1_ps (hi);
+    __m256d acc_lo = _mm256_setzero_pd ();
+    __m256d acc_hi = _mm256_setzero_pd ();
+    float lane[8];
+    int l;
+
+    for (; j + 8 <= n; j += 8) {
+        __m256 v = _mm256_loadu_ps (&row[j]);
+        vmin = _mm256_min_ps (vmin, v);
+        vmax = _mm256_max_ps (vmax, v);
+        acc_lo = _mm256_add_pd (acc_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (v)));
+        acc_hi = _mm256_add_pd (acc_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (v, 1)));
+    }
+    _mm256_storeu_ps (lane, vmin);
+    for (l = 0; l < 8; l++)
+        lo = (lane[l] < lo) ? lane[l] : lo;
+    _mm256_storeu_ps (lane, vmax);
+    for (l = 0; l < 8; l++)
+        hi = (lane[l] > hi) ? lane[l] : hi;
+    __m256d acc = _mm256_add_pd (acc_lo, acc_hi);
+    __m128d pair = _mm_add_pd (_mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1));
+    total = _mm_cvtsd_f64 (_mm_add_sd (pair, _mm_unpackhi_pd (pair, pair)));
+#endif
+
+    /* Scalar tail, or the whole row without SIMD support. */
+    for (; j < n; j++) {
+        total += row[j];
+        if (row[j] > hi)
+            hi = row[j];
+        if (row[j] < lo)
+            lo = row[j];
+    }
+
+    *min = lo;
+    *max = hi;
+    *sum += total;
+}
+
+/* Sum of the squared differences between the n points of two rows. */
+static double
+row_squared_error (const float *row_1, const float *row_2, int n)
+{
+    double total = 0.0;
+    int j = 0;
+
+#if defined (__AVX512F__)
+    __m512d acc = _mm512_setzero_pd ();
+
+    for (; j + 8 <= n; j += 8) {
+        __m512d d = _mm512_sub_pd (_mm512_cvtps_pd (_mm256_loadu_ps (&row_1[j])), _mm512_cvtps_pd (_mm256_loadu_ps (&row_2[j])));
+        acc = _mm512_fmadd_pd (d, d, acc);
+    }
+    total = _mm512_reduce_add_pd (acc);
+#elif defined (__AVX2__)
+    __m256d acc = _mm256_setzero_pd ();
+
+    for (; j + 4 <= n; j += 4) {
+        __m256d d = _mm256_sub_pd (_mm256_cvtps_pd (_mm_loadu_ps (&row_1[j])), _mm256_cvtps_pd (_mm_loadu_ps (&row_2[j])));
+        acc = _mm256_add_pd (acc, _mm256_mul_pd (d, d));
+    }
+    __m128d pair = _mm_add_pd (_mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1));
+    total = _mm_cvtsd_f64 (_mm_add_sd (pair, _mm_unpackhi_pd (pair, pair)));
+#endif
+
+    /* Scalar tail, or the whole row without SIMD support. */
+    for (; j < n; j++)
+        total += ((double) row_1[j] - row_2[j]) * ((double) row_1[j] - row_2[j]);
+
+    return total;
+}
@@ -0,0 +1,358 @@
+/* Reusable plate solver with a persistent thread team; see jacobi_solver.h for the interface.
+ *
+ * The team threads are created with the solver and park on a condition variable between solves.
+ * jacobi_solver_solve publishes the grid, starts a new generation and waits until every thread
+ * has finished it. During a solve the threads work as in the other row-block solvers: each owns a
+ * contiguous block of interior rows, counted across the planes of a 3-D grid, and the threads meet
+ * at a barrier after every iteration, where the last to arrive sums the residuals, tests for
+ * convergence and swaps the buffers. The second buffer of the jacobi method is kept between solves
+ * and only reallocated for a larger grid.
+ *
+ * The library has no globals: it can be compiled into any program, e.g.
+ * gcc -c jacobi_solver.c barrier.c -O3 -march=native -Wall -std=c99 && ar rcs libjacobi.a jacobi_solver.o barrier.o
+ * and the solver uses it for the team method and the warm start.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "stencil.h"
+#include "jacobi_solver.h"
+
+#define CACHE_LINE 64
+
+/* Structure used to pass arguments to the team threads, aligned to a cache line */
+typedef struct args_for_team_thread_t {
+    JACOBI_SOLVER *solver;
+    int thread_idx;
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_TEAM_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_TEAM_THREAD) == CACHE_LINE, "ARGS_FOR_TEAM_THREAD must fill one cache line");
+
+struct jacobi_solver_s {
+    /* Settings */
+    int num_threads;
+    int method;
+    float eps;
+    int max_iter; /* 0 for no limit */
+
+    /* Team */
+    pthread_t *thread_id;
+    ARGS_FOR_TEAM_THREAD *args;
+    BARRIER barrier;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int generation; /* Solves started */
+    int finished; /* Threads done with the current solve */
+    int shutdown;
+
+    /* Current solve */
+    grid_t *grid;
+    float *src, *dst; /* Buffers of the jacobi method: the grid and the scratch buffer */
+    float *scratch;
+    size_t scratch_size; /* Floats */
+    int num_rows; /* Interior rows, over all planes */
+    int iter;
+    int done;
+    double diff; /* Residual of the last iteration */
+};
+
+/* Function prototypes */
+static void *team_thread (void *);
+static void solve_share (JACOBI_SOLVER *, ARGS_FOR_TEAM_THREAD *);
+static void end_of_team_iteration (void *);
+static double relax_rows_jacobi (JACOBI_SOLVER *, int, int);
+static double relax_rows_color (JACOBI_SOLVER *, int, int, int);
+
+/* Create a solver with a team of num_threads threads, set up for the jacobi method to
+ * JACOBI_DEFAULT_EPS with no iteration limit. Returns NULL if the team cannot be created. */
+JACOBI_SOLVER *
+jacobi_solver_create (int num_threads)
+{
+    JACOBI_SOLVER *solver;
+    int i;
+
+    if (num_threads < 1)
+        return NULL;
+    solver = (JACOBI_SOLVER *) calloc (1, sizeof (JACOBI_SOLVER));
+    if (solver == NULL)
+        return NULL;
+    solver->num_threads = num_threads;
+    solver->method = JACOBI_METHOD_JACOBI;
+    solver->eps = JACOBI_DEFAULT_EPS;
+    solver->max_iter = 0;
+
+    solver->thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    if (solver->thread_id == NULL ||
+        posix_memalign ((void **) &solver->args, CACHE_LINE, sizeof (ARGS_FOR_TEAM_THREAD) * num_threads) != 0) {
+        free ((void *) solver->thread_id);
+        free ((void *) solver);
+        return NULL;
+    }
+    barrier_init (&solver->barrier, num_threads);
+    pthread_mutex_init (&solver->mutex, NULL);
+    pthread_cond_init (&solver->cond, NULL);
+
+    for (i = 0; i < num_threads; i++) {
+        solver->args[i].solver = solver;
+        solver->args[i].thread_idx = i;
+        solver->args[i].diff = 0.0;
+        if ((pthread_create (&solver->thread_id[i], NULL, team_thread, (void *) &solver->args[i])) != 0) {
+            perror ("pthread_create");
+            solver->num_threads = i; /* Stop the threads created so far */
+            jacobi_solver_destroy (solver);
+            return NULL;
+        }
+    }
+
+    return solver;
+}
+
+/* Select JACOBI_METHOD_JACOBI or JACOBI_METHOD_RED_BLACK. Returns 0, or -1 for any other value,
+ * which leaves the method unchanged. */
+int
+jacobi_solver_set_method (JACOBI_SOLVER *solver, int method)
+{
+    if (method != JACOBI_METHOD_JACOBI && method != JACOBI_METHOD_RED_BLACK)
+        return -1;
+    solver->method = method;
+    return 0;
+}
+
+void
+jacobi_solver_set_tolerance (JACOBI_SOLVER *solver, float eps)
+{
+    solver->eps = eps;
+}
+
+/* Stop a solve after max_iter iterations even if it has not converged; 0 removes the limit. */
+void
+jacobi_solver_set_max_iterations (JACOBI_SOLVER *solver, int max_iter)
+{
+    solver->max_iter = max_iter;
+}
+
+/* Solve grid in place, starting from its current values. Returns the number of iterations, or -1
+ * if the method does not handle the shape of the grid or memory runs out. */
+int
+jacobi_solver_solve (JACOBI_SOLVER *solver, grid_t *grid)
+{
+    size_t size = grid->plane * grid->nz;
+
+    if (grid->nx < 3 || grid->ny < 3 || (solver->method == JACOBI_METHOD_RED_BLACK && grid->nz > 1))
+        return -1;
+
+    if (solver->method == JACOBI_METHOD_JACOBI) {
+        if (size > solver->scratch_size) {
+            free ((void *) solver->scratch);
+            if (posix_memalign ((void **) &solver->scratch, GRID_ALIGN, sizeof (float) * size) != 0) {
+                solver->scratch = NULL;
+                solver->scratch_size = 0;
+                return -1;
+            }
+            solver->scratch_size = size;
+        }
+        memcpy (solver->scratch, grid->element, sizeof (float) * size); /* The boundary of the second buffer */
+    }
+
+    solver->grid = grid;
+    solver->src = grid->element;
+    solver->dst = solver->scratch;
+    solver->num_rows = (grid->nz == 1) ? grid->ny - 2 : (grid->nz - 2) * (grid->ny - 2);
+    solver->iter = 0;
+    solver->done = 0;
+    solver->diff = 0.0;
+
+    /* Start the team on the new generation and wait for it to finish. */
+    pthread_mutex_lock (&solver->mutex);
+    solver->finished = 0;
+    solver->generation++;
+    pthread_cond_broadcast (&solver->cond);
+    while (solver->finished < solver->num_threads)
+        pthread_cond_wait (&solver->cond, &solver->mutex);
+    pthread_mutex_unlock (&solver->mutex);
+
+    if (solver->src != grid->element)
+        memcpy (grid->element, solver->src, sizeof (float) * size); /* The last iteration is in the scratch buffer */
+    solver->grid = NULL;
+
+    return solver->iter;
+}
+
+/* Residual, the mean change per interior point, of the last iteration of the last solve. */
+double
+jacobi_solver_residual (const JACOBI_SOLVER *solver)
+{
+    return solver->diff;
+}
+
+/* Stop the team and release the solver. */
+void
+jacobi_solver_destroy (JACOBI_SOLVER *solver)
+{
+    int i;
+
+    pthread_mutex_lock (&solver->mutex);
+    solver->shutdown = 1;
+    pthread_cond_broadcast (&solver->cond);
+    pthread_mutex_unlock (&solver->mutex);
+    for (i = 0; i < solver->num_threads; i++)
+        pthread_join (solver->thread_id[i], NULL);
+
+    barrier_destroy (&solver->barrier);
+    pthread_mutex_destroy (&solver->mutex);
+    pthread_cond_destroy (&solver->cond);
+    free ((void *) solver->scratch);
+    free ((void *) solver->args);
+    free ((void *) solver->thread_id);
+    free ((void *) solver);
+}
+
+/* The function executed by the team threads: wait for a solve, take part in it, and report back. */
+static void *
+team_thread (void *thread_parameter)
+{
+    ARGS_FOR_TEAM_THREAD *parameter = (ARGS_FOR_TEAM_THREAD *) thread_parameter;
+    JACOBI_SOLVER *solver = parameter->solver;
+    int seen = 0; /* Generations done by this thread */
+
+    for (;;) {
+        pthread_mutex_lock (&solver->mutex);
+        while (solver->generation == seen && !solver->shutdown)
+            pthread_cond_wait (&solver->cond, &solver->mutex);
+        if (solver->shutdown) {
+            pthread_mutex_unlock (&solver->mutex);
+            break;
+        }
+        seen = solver->generation;
+        pthread_mutex_unlock (&solver->mutex);
+
+        solve_share (solver, parameter);
+
+        pthread_mutex_lock (&solver->mutex);
+        if (++solver->finished == solver->num_threads)
+            pthread_cond_broadcast (&solver->cond);
+        pthread_mutex_unlock (&solver->mutex);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Iterate on this thread's block of rows until the solve is done. */
+static void
+solve_share (JACOBI_SOLVER *solver, ARGS_FOR_TEAM_THREAD *parameter)
+{
+    int first = (parameter->thread_idx * solver->num_rows)/solver->num_threads;
+    int last = ((parameter->thread_idx + 1) * solver->num_rows)/solver->num_threads;
+
+    while (!solver->done) {
+        if (solver->method == JACOBI_METHOD_RED_BLACK) {
+            double diff = relax_rows_color (solver, first, last, 0); /* Red half-sweep */
+            barrier_sync (&solver->barrier, NULL, NULL);
+            parameter->diff = diff + relax_rows_color (solver, first, last, 1); /* Black half-sweep */
+        }
+        else
+            parameter->diff = relax_rows_jacobi (solver, first, last);
+
+        barrier_sync (&solver->barrier, end_of_team_iteration, solver); /* Wait here for all threads at the end of each iteration */
+    }
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence and swaps the buffers. */
+static void
+end_of_team_iteration (void *arg)
+{
+    JACOBI_SOLVER *solver = (JACOBI_SOLVER *) arg;
+    double diff = 0.0;
+    float *temp;
+    int i;
+
+    for (i = 0; i < solver->num_threads; i++)
+        diff += solver->args[i].diff;
+    solver->diff = diff/GRID_INTERIOR (solver->grid);
+    solver->iter++;
+    if (solver->diff < solver->eps || solver->iter == solver->max_iter)
+        solver->done = 1;
+
+    if (solver->method == JACOBI_METHOD_JACOBI) {
+        temp = solver->src;
+        solver->src = solver->dst;
+        solver->dst = temp;
+    }
+}
+
+/* Jacobi update of interior rows [first, last) from src into dst. Returns the sum of |new - old|. */
+static double
+relax_rows_jacobi (JACOBI_SOLVER *solver, int first, int last)
+{
+    grid_t *grid = solver->grid;
+    const float *src = solver->src;
+    float *dst = solver->dst;
+    int rows_per_plane = grid->ny - 2;
+    size_t stride = grid->stride;
+    size_t plane = grid->plane;
+    double diff = 0.0;
+    float old, new;
+    int r, j;
+
+    for (r = first; r < last; r++) {
+        size_t row = ((grid->nz == 1) ? 0 : (1 + r / rows_per_plane) * plane) + (1 + r % rows_per_plane) * stride;
+
+        if (grid->nz == 1) {
+            diff += stencil_relax_row (&stencil_5point, &src[row], &dst[row], stride, NULL, NULL, 1, grid->nx - 1);
+            continue;
+        }
+        for (j = 1; j < (grid->nx - 1); j++) {
+            size_t idx = row + j;
+            old = src[idx]; /* Store old value of grid point. */
+            /* Apply the update rule. */
+            new = (1.0/6.0) * (src[idx - plane] +\
+                               src[idx + plane] +\
+                               src[idx - stride] +\
+                               src[idx + stride] +\
+                               src[idx + 1] +\
+                               src[idx - 1]);
+
+            dst[idx] = new; /* Update the grid-point value. */
+            diff = diff + fabs (new - old); /* Calculate the difference in values. */
+        }
+    }
+
+    return diff;
+}
+
+/* Gauss-Seidel update, in place, of the points of the given color, (i + j) % 2 == color, in
+ * interior rows [first, last). Returns the sum of |new - old|. */
+static double
+relax_rows_color (JACOBI_SOLVER *solver, int first, int last, int color)
+{
+    grid_t *grid = solver->grid;
+    float *element = grid->element;
+    size_t stride = grid->stride;
+    double diff = 0.0;
+    float old, new;
+    int i, j;
+
+    for (i = 1 + first; i < 1 + last; i++) {
+        for (j = 1 + ((i + 1 + color) & 1); j < (grid->nx - 1); j += 2) {
+            old = element[i * stride + j]; /* Store old value of grid point. */
+            /* Apply the update rule. */
+            new = 0.25 * (element[(i - 1) * stride + j] +\
+                          element[(i + 1) * stride + j] +\
+                          element[i * stride + (j + 1)] +\
+                          element[i * stride + (j - 1)]);
+
+            element[i * stride + j] = new; /* Update the grid-point value. */
+            diff = diff + fabs (new - old); /* Calculate the difference in values. */
+        }
+    }
+
+    return diff;
+}
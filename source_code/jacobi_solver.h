@@ -0,0 +1,26 @@
+#ifndef __JACOBI_SOLVER__
+#define __JACOBI_SOLVER__
+
+#include "grid.h"
+
+/* Reusable solver for the plate problem, for programs that solve plates of their own. A solver
+ * owns a team of threads that is created once by jacobi_solver_create and serves every call to
+ * jacobi_solver_solve until jacobi_solver_destroy, so a sequence of plates pays for the thread
+ * setup once. All the state of a solve lives in the solver, so several solvers can be used in one
+ * process; one solver must not be used by two threads at a time. */
+typedef struct jacobi_solver_s JACOBI_SOLVER;
+
+#define JACOBI_METHOD_JACOBI 0 /* Jacobi iteration, 2-D and 3-D grids of any shape */
+#define JACOBI_METHOD_RED_BLACK 1 /* Red-black Gauss-Seidel, in place, 2-D grids only */
+
+#define JACOBI_DEFAULT_EPS 1e-2 /* Convergence criterion of the solvers in this repository */
+
+JACOBI_SOLVER *jacobi_solver_create (int);
+int jacobi_solver_set_method (JACOBI_SOLVER *, int);
+void jacobi_solver_set_tolerance (JACOBI_SOLVER *, float);
+void jacobi_solver_set_max_iterations (JACOBI_SOLVER *, int);
+int jacobi_solver_solve (JACOBI_SOLVER *, grid_t *);
+double jacobi_solver_residual (const JACOBI_SOLVER *);
+void jacobi_solver_destroy (JACOBI_SOLVER *);
+
+#endif
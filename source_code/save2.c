@@ -109,6 +109,8 @@ main (int argc, char **argv)
 	free ((void *) grid_1); 
 	free ((void *) grid_2->element);	
 	free ((void *) grid_2);
+    free ((void *) grid_temp->element);	
+	free ((void *) grid_temp);
 
 	exit (EXIT_SUCCESS);
 }
@@ -215,8 +217,10 @@ barrier_sync (BARRIER *barrier)
         /*Reset diff each iteration*/
         diff2 = 0.0;
         num_elements2 = 0;
-        /*Parse temporary grid to original grid_2 to start new iteration*/
-        grid_2 = copy_grid(grid_temp);
+        /*Swap the buffers so that the temporary grid becomes grid_2 for the new iteration*/
+        float *temp = grid_2->element;
+        grid_2->element = grid_temp->element;
+        grid_temp->element = temp;
         barrier->counter = 0; /* Reset the counter */    
         sem_post (&(barrier->counter_sem)); /* Signal the blocked threads that it is now safe to cross the barrier */			 
         
@@ -239,7 +243,10 @@ create_grid (int dim, float min, float max)
     if (grid == NULL)
         return NULL;
 
-    grid->dim = dim;
+    grid->dim = grid->nx = grid->ny = dim; /* Unpadded rows */
+    grid->nz = 1;
+    grid->stride = dim;
+    grid->plane = (size_t) dim * dim;
 	printf("Creating a grid of dimension %d x %d\n", grid->dim, grid->dim);
 	grid->element = (float *) malloc (sizeof (float) * grid->dim * grid->dim);
     if (grid->element == NULL)
@@ -271,7 +278,7 @@ copy_grid (grid_t *grid)
     if (new_grid == NULL)
         return NULL;
 
-    new_grid->dim = grid->dim;
+    *new_grid = *grid; /* Same shape and layout */
 	new_grid->element = (float *) malloc (sizeof (float) * new_grid->dim * new_grid->dim);
     if (new_grid->element == NULL)
         return NULL;
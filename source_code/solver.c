@@ -4,89 +4,394 @@
  * Date modified: February 21, 2020
  *
  * Compile as follows:
- * gcc -o solver solver.c solver_gold.c -O3 -Wall -std=c99 -lm -lpthread
+ * gcc -o solver solver.c solver_gold.c barrier.c solver_tiled.c solver_simd.c solver_rb.c solver_mg.c solver_cg.c solver_async.c solver_blocks.c solver_mixed.c checkpoint.c solver_ooc.c solver_mp.c transport_shm.c solver_stencil.c solver_batch.c solver_warm.c solver_heat.c frames.c trace.c grid_parallel.c jacobi_solver.c solver_tune.c -O3 -march=native -Wall -std=c99 -lm -lpthread -lrt
+ *
+ * For compressed frames in the transient mode, add -D HAVE_ZLIB and -lz.
  *
  * If you wish to see debug info, add the -D DEBUG option when compiling the code.
  */
 
+#define _XOPEN_SOURCE 600
+
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
 #include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <semaphore.h>
 #include <pthread.h>
 #include <math.h>
 #include "grid.h" 
+#include "barrier.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "jacobi_solver.h"
 
-typedef struct barrier_struct {
-    sem_t counter_sem; /* Protects access to the counter */
-    sem_t barrier_sem; /*Signals that barrier is safe to cross */
-    int counter; /* The counter of threads */
-    int row_count; /*The counter of finished rows*/
-} BARRIER;
+#define CACHE_LINE 64
+#define CONVERGED_EPS 1e-6 /* Tolerance of the converged plate the warm and cold starts are measured against */
 
-/* Structure used to pass arguments to the worker threads */
+/* Structure used to pass arguments to the worker threads. Holds the thread's residual for the 
+ * two most recent iterations, aligned to a cache line. */
 typedef struct args_for_thread_t {
     int thread_idx;
-} ARGS_FOR_THREAD; 
+    double diff[2];
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_THREAD) == CACHE_LINE, "ARGS_FOR_THREAD must fill one cache line");
+
+/* Solution methods that can be selected on the command line */
+typedef struct method_t {
+    const char *name;
+    int (*solve) (grid_t *, int);
+    const char *description;
+    int any_shape; /* Solves rectangular and 3-D grids, not only square 2-D ones */
+} METHOD;
 
 /* Create the barrier data structure */
 BARRIER barrier; 
 
 /* Function prototypes */
 void *my_thread (void *);
-void barrier_sync (BARRIER *);
+void end_of_iteration (void *);
+int check_convergence (int);
+static double pairwise_sum (const double *, int);
 
 extern int compute_gold (grid_t *);
 int compute_using_pthreads_jacobi (grid_t *, int);
+int compute_using_jacobi_solver (grid_t *, int);
+extern int compute_using_pthreads_jacobi_tiled (grid_t *, int);
+extern int compute_using_pthreads_jacobi_simd (grid_t *, int);
+extern int compute_using_pthreads_jacobi_blocks (grid_t *, int);
+extern int compute_using_pthreads_stencil (grid_t *, int);
+extern int compute_gold_stencil (grid_t *);
+extern int select_stencil (const char *);
+extern int compute_using_pthreads_jacobi_mixed (grid_t *, int);
+extern int compute_using_pthreads_out_of_core (grid_t *, int);
+extern void solve_plate_out_of_core (const char *, int, int, float, float);
+extern int compute_using_processes (grid_t *, int);
+extern void solve_batch (const char *, int);
+extern int warm_start (grid_t *, int);
+extern void solve_transient (grid_t *, int, int, const char *, int, int);
+extern void autotune (grid_t *, int, int, const char **, int *);
+extern int compute_using_pthreads_red_black (grid_t *, int);
+extern int compute_using_pthreads_sor (grid_t *, int);
+extern int compute_using_pthreads_sor_adaptive (grid_t *, int);
+extern int compute_using_pthreads_multigrid (grid_t *, int);
+extern int compute_using_pthreads_cg (grid_t *, int);
+extern int compute_using_pthreads_cg_sgs (grid_t *, int);
+extern int compute_using_pthreads_async (grid_t *, int);
 void compute_grid_differences(grid_t *, grid_t *);
 grid_t *create_grid (int, float, float);
+grid_t *create_grid_3d (int, int, int, float, float);
+grid_t *allocate_grid (int, int, int);
 grid_t *copy_grid (grid_t *);
 void print_grid (grid_t *);
 void print_stats (grid_t *);
 double grid_mse (grid_t *, grid_t *);
+static grid_t *allocate_grid_layout (int, int, int);
+extern void parallel_zero_grid (grid_t *, int);
+extern void parallel_copy_grid (grid_t *, grid_t *, int);
+extern size_t parallel_grid_stats (grid_t *, int, float *, float *, double *);
+extern double parallel_grid_mse (grid_t *, grid_t *, int);
 
 /*Shared variables*/
 int num_threads;
 int total_iter = 0;
 float eps = 1e-2; /* Convergence criteria. */
-int num_elements2 = 0; 
+size_t num_elements2 = 0; 
 int done2 = 0;
-double diff2 = 0.0;
+int converged2 = 0; /* Set when the pipelined check finds the previous iteration converged */
+int check_interval = 1; /* Test for convergence every check_interval iterations */
+int pipelined_check = 0; /* Overlap the convergence test with the next iteration */
+double last_diff = 0.0; /* Residual of the most recent convergence test */
+int max_iter = 0; /* If nonzero, the jacobi, team, tiled, simd and blocks methods stop after this many iterations */
+ARGS_FOR_THREAD *jacobi_args;
+int reproducible = 0; /* Sum the residual by rows, in an order independent of the thread count */
+int num_rows2; /* Interior rows, over all planes */
+double *row_diff2[2]; /* Residual of each interior row, for the two most recent iterations */
+
+char *checkpoint_path = NULL; /* Checkpoint file, if any */
+int checkpoint_interval = 1000; /* Iterations between two checkpoints */
+CHECKPOINT checkpoint;
+float *snapshot = NULL; /* Checkpoint slot being filled by the threads during this iteration */
+int snapshot_iter;
 
 grid_t *grid_2;
 grid_t *grid_temp;
 
+METHOD methods[] = {
+    {"jacobi", compute_using_pthreads_jacobi, "jacobi method, column-cyclic threads (default)", 1},
+    {"team", compute_using_jacobi_solver, "jacobi method through the reusable JACOBI_SOLVER interface, row blocks", 1},
+    {"tiled", compute_using_pthreads_jacobi_tiled, "jacobi method, cache-blocked tiles with temporal blocking", 0},
+    {"simd", compute_using_pthreads_jacobi_simd, "jacobi method, AVX2/AVX-512 row kernel on a padded grid", 0},
+    {"blocks", compute_using_pthreads_jacobi_blocks, "jacobi method, 2-D blocks shaped from the grid and thread count", 0},
+    {"stencil", compute_using_pthreads_stencil, "jacobi method for the stencil selected with -S, row blocks", 0},
+    {"mixed", compute_using_pthreads_jacobi_mixed, "jacobi method, 16-bit storage until the residual nears eps, then float", 0},
+    {"ooc", compute_using_pthreads_out_of_core, "jacobi method, out of core through a temporary file, temporal blocking", 0},
+    {"mp", compute_using_processes, "jacobi method, one process per strip (num-threads processes), shared-memory halos", 0},
+    {"rb", compute_using_pthreads_red_black, "red-black Gauss-Seidel, in place, two half-sweeps per iteration", 0},
+    {"sor", compute_using_pthreads_sor, "red-black SOR, omega from the grid dimension", 0},
+    {"sor-adaptive", compute_using_pthreads_sor_adaptive, "red-black SOR, omega adapted from the residual decay", 0},
+    {"mg", compute_using_pthreads_multigrid, "geometric multigrid V-cycles with red-black smoothing", 0},
+    {"cg", compute_using_pthreads_cg, "conjugate gradient, jacobi preconditioner", 0},
+    {"cg-sgs", compute_using_pthreads_cg_sgs, "conjugate gradient, red-black symmetric Gauss-Seidel preconditioner", 0},
+    {"async", compute_using_pthreads_async, "asynchronous relaxation, no global barriers, neighbor halos only", 0},
+    {NULL, NULL, NULL, 0}
+};
+
 int 
 main (int argc, char **argv)
 {	
-	if (argc < 5) {
-        printf ("Usage: %s grid-dimension num-threads min-temp max-temp\n", argv[0]);
-        printf ("grid-dimension: The dimension of the grid\n");
+    METHOD *method = &methods[0];
+    int i, j, c;
+    int nx, ny, nz = 1;
+    int shape_args;
+    int bad_option = 0;
+    int resume = 0;
+    int warm = 0;
+    int time_steps = -1;
+    int frame_interval = 100;
+    int compress = 0;
+    char *frames_path = NULL;
+    int trace = 0;
+    int tune = 0, retune = 0;
+    int stencil_option = 0;
+    char *trace_path = NULL;
+    char *ooc_path = NULL;
+    char *batch_path = NULL;
+    char *program = argv[0];
+    struct option long_options[] = {
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"checkpoint-interval", required_argument, NULL, 'K'},
+        {"resume", no_argument, NULL, 'r'},
+        {"out-of-core", required_argument, NULL, 'o'},
+        {"stencil", required_argument, NULL, 'S'},
+        {"batch", required_argument, NULL, 'B'},
+        {"warm-start", no_argument, NULL, 'w'},
+        {"time-steps", required_argument, NULL, 'T'},
+        {"frames", required_argument, NULL, 'f'},
+        {"frame-interval", required_argument, NULL, 'F'},
+        {"compress", no_argument, NULL, 'z'},
+        {"reproducible", no_argument, NULL, 'R'},
+        {"trace", no_argument, NULL, 't'},
+        {"autotune", no_argument, NULL, 'A'},
+        {"retune", no_argument, NULL, 'U'},
+        {"trace-json", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}
+    };
+
+    /* Parse the options, then the positional arguments. */
+    while ((c = getopt_long (argc, argv, "c:pRk:K:ro:S:B:wT:f:F:ztj:AU", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'c':
+                check_interval = atoi (optarg);
+                break;
+            case 'p':
+                pipelined_check = 1;
+                break;
+            case 'R':
+                reproducible = 1;
+                break;
+            case 'k':
+                checkpoint_path = optarg;
+                break;
+            case 'K':
+                checkpoint_interval = atoi (optarg);
+                break;
+            case 'r':
+                resume = 1;
+                break;
+            case 'o':
+                ooc_path = optarg;
+                break;
+            case 'w':
+                warm = 1;
+                break;
+            case 'T':
+                time_steps = atoi (optarg);
+                break;
+            case 'f':
+                frames_path = optarg;
+                break;
+            case 'F':
+                frame_interval = atoi (optarg);
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            case 't':
+                trace = 1;
+                break;
+            case 'U':
+                retune = 1;
+                /* Fall through */
+            case 'A':
+                tune = 1;
+                break;
+            case 'j':
+                trace = 1;
+                trace_path = optarg;
+                break;
+            case 'B':
+                batch_path = optarg;
+                break;
+            case 'S':
+                if (select_stencil (optarg) != 0)
+                    bad_option = 1;
+                stencil_option = 1;
+                break;
+            default:
+                bad_option = 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (batch_path != NULL && !bad_option && !stencil_option && argc == 2) {
+        /* The plates come from the file; the only argument is the number of threads. */
+        solve_batch (batch_path, atoi (argv[1]) > 0 ? atoi (argv[1]) : 1);
+        exit (EXIT_SUCCESS);
+    }
+
+	if (argc > 5) {
+        for (method = methods; method->name != NULL; method++)
+            if (strcmp (method->name, argv[5]) == 0)
+                break;
+    }
+
+    /* The grid dimension is N for an N x N plate, NXxNY for a rectangular plate of NY rows of NX
+     * points, or NXxNYxNZ for a block of NZ planes. */
+    shape_args = (argc < 5) ? 0 : sscanf (argv[1], "%dx%dx%d", &nx, &ny, &nz);
+    if (shape_args == 1)
+        ny = nx;
+    if (shape_args < 1 || nx < 3 || ny < 3 || nz < 1 || nz == 2)
+        bad_option = 1;
+    else if ((nx != ny || nz > 1) && ((method->name != NULL && !method->any_shape) || checkpoint_path != NULL || ooc_path != NULL || warm || time_steps >= 0 || tune))
+        bad_option = 1; /* The other methods and the checkpoint, out-of-core, warm start, transient and autotune modes only handle square plates */
+    if (checkpoint_path != NULL && method->solve != compute_using_pthreads_jacobi)
+        bad_option = 1; /* Only the jacobi method writes checkpoints, and a restored grid is a jacobi iterate */
+    if (warm && (checkpoint_path != NULL || method->solve == compute_using_pthreads_stencil))
+        bad_option = 1; /* The coarse plates and the converged plate use the 5-point stencil */
+    if (time_steps >= 0 && (warm || checkpoint_path != NULL))
+        bad_option = 1;
+    if (tune && (warm || checkpoint_path != NULL || argc > 5))
+        bad_option = 1; /* The tuner picks the method */
+    if ((frames_path != NULL && time_steps < 0) || frame_interval < 1 || (compress && frames_path == NULL))
+        bad_option = 1;
+    if ((check_interval != 1 || pipelined_check) && (method->solve != compute_using_pthreads_jacobi || tune))
+        bad_option = 1; /* Only the jacobi method has the reduced-frequency and pipelined checks */
+    if (reproducible && (method->solve != compute_using_pthreads_jacobi || tune))
+        bad_option = 1; /* Only the jacobi method sums the residual in a fixed order */
+    if (stencil_option && (method->solve != compute_using_pthreads_stencil || tune || time_steps >= 0))
+        bad_option = 1; /* The other methods, the batch plates and the transient mode use the 5-point stencil */
+
+    if (bad_option || argc < 5 || method->name == NULL || (resume && checkpoint_path == NULL) || checkpoint_interval < 1) {
+        printf ("Usage: %s [options] grid-dimension num-threads min-temp max-temp [method]\n", program);
+        printf ("       %s -B file num-threads\n", program);
+        printf ("grid-dimension: The dimension of the grid: N for N x N, NXxNY for NY rows of NX points, or NXxNYxNZ for NZ planes.\n");
+        printf ("                Only the jacobi and team methods solve grids that are not square and 2-D\n");
         printf ("num-threads: Number of threads\n"); 
         printf ("min-temp, max-temp: Heat applied to the north side of the plate is uniformly distributed between min-temp and max-temp\n");
+        printf ("method: One of\n");
+        for (i = 0; methods[i].name != NULL; i++)
+            printf ("\t%-12s %s\n", methods[i].name, methods[i].description);
+        printf ("options (jacobi method):\n");
+        printf ("\t-c k         Test for convergence every k iterations\n");
+        printf ("\t-p           Test for convergence of each iteration while computing the next\n");
+        printf ("\t-R, --reproducible\n");
+        printf ("\t             Same residuals, iteration count and grid for any number of threads\n");
+        printf ("\t-k, --checkpoint file\n");
+        printf ("\t             Checkpoint the grid to file while solving\n");
+        printf ("\t-K, --checkpoint-interval k\n");
+        printf ("\t             Iterations between two checkpoints (default 1000)\n");
+        printf ("\t-r, --resume Continue from the latest valid checkpoint in the checkpoint file\n");
+        printf ("options (stencil method):\n");
+        printf ("\t-S, --stencil name\n");
+        printf ("\t             Operator: 5point (default), 9point, aniso or varcoef\n");
+        printf ("options (other):\n");
+        printf ("\t-t, --trace  Time the sweeps and barrier waits of each thread and print a summary\n");
+        printf ("\t             (jacobi, tiled, simd, blocks and stencil methods)\n");
+        printf ("\t-j, --trace-json file\n");
+        printf ("\t             As -t, and also write the events to file as a Chrome trace\n");
+        printf ("\t-A, --autotune\n");
+        printf ("\t             Choose the method, the number of threads (at most num-threads) and the tile size\n");
+        printf ("\t             from short calibration runs; the choice is cached in .solver_tune and reused\n");
+        printf ("\t-U, --retune As -A, but calibrate even if the cache has a choice\n");
+        printf ("\t-w, --warm-start\n");
+        printf ("\t             Start from the interpolated solution of coarser plates, and compare with a cold start\n");
+        printf ("\t             by the distance of each from the plate converged with multigrid\n");
+        printf ("\t-o, --out-of-core file\n");
+        printf ("\t             Solve the plate in file, out of core, without the reference solution\n");
+        printf ("\t-B, --batch file\n");
+        printf ("\t             Solve the plates listed in file, one \"dim min-temp max-temp\" per line, and report plates/s\n");
+        printf ("options (transient mode):\n");
+        printf ("\t-T, --time-steps n\n");
+        printf ("\t             Advance the heat equation n explicit time steps from the initial conditions instead of solving\n");
+        printf ("\t-f, --frames file\n");
+        printf ("\t             Stream frames of the plate to file while stepping\n");
+        printf ("\t-F, --frame-interval k\n");
+        printf ("\t             Time steps between two frames (default 100)\n");
+        printf ("\t-z, --compress\n");
+        printf ("\t             Compress the frames with zlib\n");
         exit (EXIT_FAILURE);
     }
     
     /* Parse command-line arguments. */
-    int dim = atoi (argv[1]);
+    int dim = nx;
     num_threads = atoi (argv[2]);
     float min_temp = atof (argv[3]);
     float max_temp = atof (argv[4]);
+
+    if (ooc_path != NULL) {
+        /* The grids may not fit in memory: skip the reference solution and the in-memory methods. */
+        solve_plate_out_of_core (ooc_path, dim, num_threads, min_temp, max_temp);
+        exit (EXIT_SUCCESS);
+    }
     
     /* Generate the grids and populate them with initial conditions. */
- 	grid_t *grid_1 = create_grid (dim, min_temp, max_temp);
+ 	grid_t *grid_1 = create_grid_3d (nx, ny, nz, min_temp, max_temp);
     /* Grid 2 should have the same initial conditions as Grid 1. */
     grid_2 = copy_grid (grid_1);  // grid 2 = grid 1
-    grid_temp = copy_grid (grid_2); 
+
+    if (tune) {
+        const char *name;
+        autotune (grid_1, num_threads, retune, &name, &num_threads);
+        for (method = methods; strcmp (method->name, name) != 0; method++)
+            ;
+    }
+
+    if (time_steps >= 0) {
+        /* Transient mode: there is no converged reference solution to compare with. */
+        solve_transient (grid_2, num_threads, time_steps, frames_path, frame_interval, compress);
+        exit (EXIT_SUCCESS);
+    }
+
+    if (checkpoint_path != NULL) {
+        checkpoint_open (&checkpoint, checkpoint_path, dim, grid_2->stride);
+        if (resume) {
+            if (checkpoint_restore (&checkpoint, grid_2->element, &total_iter, &last_diff) == 0) {
+                printf ("Resuming from the checkpoint of iteration %d, DIFF: %f\n", total_iter, last_diff);
+                /* The reference solution starts from the boundary of the checkpointed grid. */
+                for (i = 0; i < dim; i++) {
+                    for (j = 0; j < dim; j++) {
+                        int boundary = (i == 0 || i == dim - 1 || j == 0 || j == dim - 1);
+                        grid_1->element[i * grid_1->stride + j] = boundary ? grid_2->element[i * grid_2->stride + j] : 0.0;
+                    }
+                }
+            }
+            else
+                printf ("No valid checkpoint in %s, starting from the beginning\n", checkpoint_path);
+        }
+    }
     // print_grid(grid_1);
     // print_grid(grid_2);
-    // print_grid(grid_temp);
 
 	/* Compute the reference solution using the single-threaded version. */
 	printf ("\nUsing the single threaded version to solve the grid\n");
-	int num_iter = compute_gold (grid_1);
+	int num_iter = (method->solve == compute_using_pthreads_stencil) ? compute_gold_stencil (grid_1) : compute_gold (grid_1);
 	printf ("Convergence achieved after %d iterations\n", num_iter);
     /* Print key statistics for the converged values. */
 	printf ("Printing statistics for the interior grid points\n");
@@ -95,10 +400,52 @@ main (int argc, char **argv)
     print_grid (grid_1);
 #endif
 	
-	/* Use pthreads to solve the equation using the jacobi method. */
-	printf ("\nUsing pthreads to solve the grid using the jacobi method\n");
-	num_iter = compute_using_pthreads_jacobi (grid_2, num_threads);
+    struct timeval start, stop;
+    int cold_iter = 0, coarse_iter = 0;
+    double cold_time = 0.0, cold_mse = 0.0, cold_error = 0.0;
+    grid_t *grid_converged = NULL;
+    if (warm) {
+        /* The reference solution stops at eps like the solvers do, well short of the solution of the
+         * plate, and a warm start stops at a different point of the way. The accuracy of the two
+         * starts is therefore measured against the plate converged to CONVERGED_EPS by multigrid. */
+        float saved_eps = eps;
+        grid_converged = copy_grid (grid_2);
+        printf ("\nUsing multigrid to converge the grid to %g, for the comparison of the starts\n", CONVERGED_EPS);
+        eps = CONVERGED_EPS;
+        compute_using_pthreads_multigrid (grid_converged, num_threads);
+        eps = saved_eps;
+
+        /* Solve a copy from the usual initial conditions, for comparison. */
+        grid_t *grid_warm = grid_2;
+        grid_t *grid_cold = copy_grid (grid_2);
+        printf ("\nUsing pthreads to solve the grid using the %s method, cold start\n", method->name);
+        gettimeofday (&start, NULL);
+        cold_iter = method->solve (grid_cold, num_threads);
+        gettimeofday (&stop, NULL);
+        cold_time = stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/1000000.0;
+        cold_mse = grid_mse (grid_1, grid_cold);
+        cold_error = grid_mse (grid_converged, grid_cold);
+        total_iter = 0;
+        grid_2 = grid_warm; /* The jacobi method points grid 2 at the grid it solves */
+        free ((void *) grid_cold->element);
+        free ((void *) grid_cold);
+    }
+
+	/* Use pthreads to solve the equation using the selected method. */
+	printf ("\nUsing pthreads to solve the grid using the %s method%s\n", method->name, warm ? ", warm start" : "");
+    gettimeofday (&start, NULL);
+    if (warm)
+        coarse_iter = warm_start (grid_2, num_threads);
+    if (trace)
+        trace_begin (num_threads);
+    num_iter = method->solve (grid_2, num_threads);
+    gettimeofday (&stop, NULL);
 	printf ("Convergence achieved after %d iterations\n", num_iter);			
+    if (checkpoint_path != NULL)
+        checkpoint_close (&checkpoint);
+    printf ("Execution time = %fs\n", (float) (stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000));
+    if (trace)
+        trace_report ((double) num_iter * GRID_INTERIOR (grid_2), trace_path);
     printf ("Printing statistics for the interior grid points\n");
 	print_stats (grid_2);
 #ifdef DEBUG
@@ -108,22 +455,48 @@ main (int argc, char **argv)
     /* Compute grid differences. */
     double mse = grid_mse (grid_1, grid_2);
     printf ("MSE between the two grids: %f\n", mse);
+    if (warm) {
+        double warm_time = stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/1000000.0;
+        double warm_error = grid_mse (grid_converged, grid_2);
+        printf ("Cold start: %d iterations in %fs, MSE %f, MSE from the converged plate %f\n", cold_iter, cold_time,
+                cold_mse, cold_error);
+        printf ("Warm start: %d iterations on coarse plates and %d on the grid in %fs, MSE %f, MSE from the converged plate %f\n",
+                coarse_iter, num_iter, warm_time, mse, warm_error);
+        if (warm_error <= cold_error)
+            printf ("Warm start: %.2fx the speed of the cold start, at least as close to the converged plate\n", cold_time/warm_time);
+        else
+            printf ("Warm start: further from the converged plate than the cold start, the times do not compare\n");
+        free ((void *) grid_converged->element);
+        free ((void *) grid_converged);
+    }
 
     // print_grid(grid_1);
     // print_grid(grid_2);
-    // print_grid(grid_temp);
 	/* Free up the grid data structures. */
 	free ((void *) grid_1->element);	
 	free ((void *) grid_1); 
 	free ((void *) grid_2->element);	
 	free ((void *) grid_2);
-    free ((void *) grid_temp->element);	
-	free ((void *) grid_temp);
 
 	exit (EXIT_SUCCESS);
 }
 
-/* FIXME: Edit this function to use the jacobi method of solving the equation. The final result should be placed in the grid data structure. */
+/* Solve the grid using the jacobi method. Two preallocated buffers, grid_2 and grid_temp, swap roles 
+ * at the end of every iteration, so the final result is always placed in the grid data structure. 
+ *
+ * By default the last thread to reach the barrier sums the per-thread residuals and tests for 
+ * convergence after every iteration. With check_interval = k the residual is only computed and 
+ * tested every k iterations, so the solver may run up to k - 1 iterations past the first one that 
+ * meets eps. With pipelined_check the residual of iteration i is summed and tested by one thread 
+ * while it computes iteration i + 1, so the barrier itself only swaps the buffers; once iteration i 
+ * is found to have converged, iteration i + 1 is discarded and the stop iteration is exact.
+ *
+ * The per-thread residuals depend on how the points are divided among the threads, so their sum,
+ * and with it the iteration count, can change with num_threads. With reproducible set each thread
+ * updates a contiguous block of whole interior rows instead of columns, the residual of each row is
+ * summed from left to right into its own slot, and the row residuals are added by pairwise_sum in a
+ * fixed order. Grid values never depend on the decomposition, so the residuals, the iteration count
+ * and the final grid are then bitwise identical for any number of threads. */
 int 
 compute_using_pthreads_jacobi (grid_t *grid, int num_threads)
 {		
@@ -131,18 +504,35 @@ compute_using_pthreads_jacobi (grid_t *grid, int num_threads)
     ARGS_FOR_THREAD *thread_parameter;
 
     int i;
-    /* Initialize the barrier data structure */
-    barrier.counter = 0;
-    barrier.row_count = 0;
-    sem_init (&barrier.counter_sem, 0, 1); /* Initialize the semaphore protecting the counter to 1 */
-    sem_init (&barrier.barrier_sem, 0, 0); /* Initialize the semaphore protecting the barrier to 0 */
-    
+    grid_2 = grid;
+    grid_temp = copy_grid (grid); /* Second buffer, swapped with grid 2 each iteration */
+    done2 = 0;
+    converged2 = 0;
+    num_elements2 = GRID_INTERIOR (grid);
+    num_rows2 = (grid->nz == 1) ? grid->ny - 2 : (grid->nz - 2) * (grid->ny - 2);
+    if (reproducible) {
+        for (i = 0; i < 2; i++) {
+            if (posix_memalign ((void **) &row_diff2[i], CACHE_LINE, sizeof (double) * num_rows2) != 0) {
+                perror ("posix_memalign");
+                exit (EXIT_FAILURE);
+            }
+        }
+    }
+    if (check_interval < 1)
+        check_interval = 1;
+    barrier_init (&barrier, num_threads); /* Initialize the barrier data structure */
+
+    /* Per-thread residual slots, one cache line per thread */
+    if (posix_memalign ((void **) &thread_parameter, CACHE_LINE, sizeof (ARGS_FOR_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    jacobi_args = thread_parameter;
      
     /* Create the threads */
     for (i = 0; i < num_threads; i++){
-        thread_parameter = (ARGS_FOR_THREAD *) malloc (sizeof (ARGS_FOR_THREAD)); /* Memory for structure to pack the arguments */
-        thread_parameter->thread_idx = i+1;
-        if ((pthread_create (&thread_id[i], NULL, my_thread, (void *)thread_parameter)) != 0) {
+        thread_parameter[i].thread_idx = i+1;
+        if ((pthread_create (&thread_id[i], NULL, my_thread, (void *) &thread_parameter[i])) != 0) {
             perror ("pthread_create");
             exit (EXIT_FAILURE);
         }
@@ -153,138 +543,287 @@ compute_using_pthreads_jacobi (grid_t *grid, int num_threads)
         pthread_join (thread_id[i], NULL);
     }
 
+    barrier_destroy (&barrier);
+    free ((void *) grid_temp->element);	
+	free ((void *) grid_temp);
+    free ((void *) thread_parameter);
     free ((void *) thread_id);
-    //pthread_exit (NULL);
+    if (reproducible) {
+        free ((void *) row_diff2[0]);
+        free ((void *) row_diff2[1]);
+    }
     return total_iter;
 }
 
-/* The function executed by the threads. */
+/* Solve the grid with a JACOBI_SOLVER (jacobi_solver.h), the interface for programs that embed
+ * the solver. Its thread team lives as long as the solver, here a single solve. */
+int
+compute_using_jacobi_solver (grid_t *grid, int num_threads)
+{
+    JACOBI_SOLVER *solver = jacobi_solver_create (num_threads);
+    int num_iter;
+
+    if (solver == NULL) {
+        fprintf (stderr, "Cannot create a solver with %d threads\n", num_threads);
+        exit (EXIT_FAILURE);
+    }
+    jacobi_solver_set_tolerance (solver, eps);
+    jacobi_solver_set_max_iterations (solver, max_iter);
+    num_iter = jacobi_solver_solve (solver, grid);
+    jacobi_solver_destroy (solver);
+
+    return num_iter;
+}
+
+/* The function executed by the threads. Each thread reads the current buffer, grid_2, 
+ * and writes its columns of the next buffer, grid_temp. A 3-D grid is updated plane by plane 
+ * with the 7-point stencil, each thread taking the same columns in every row of every plane. */
 void *
 my_thread (void *thread_parameter)
 {
     ARGS_FOR_THREAD *parameter = (ARGS_FOR_THREAD *) thread_parameter; /* Typecast argument passed to function to appropriate type */
 	float old, new;
+    int nx = grid_2->nx, ny = grid_2->ny, nz = grid_2->nz;
+    size_t stride = grid_2->stride;
+    size_t plane = grid_2->plane;
 
     while (!done2){
-        int element_count = 0;
         double diff_temp = 0.0;
-        for (int i = 1; i < (grid_2->dim - 1); i++) {    
-            for ( int j = parameter->thread_idx; j < (grid_2->dim - 1); j+= num_threads) {
-                old = grid_2->element[i * grid_2->dim + j]; /* Store old value of grid point. */
-                /* Apply the update rule. */	
-                new = 0.25 * (grid_2->element[(i - 1) * grid_2->dim + j] +\
-                              grid_2->element[(i + 1) * grid_2->dim + j] +\
-                              grid_2->element[i * grid_2->dim + (j + 1)] +\
-                              grid_2->element[i * grid_2->dim + (j - 1)]);
-
-                grid_temp->element[i * grid_2->dim + j] = new; /* Update the grid-point value. */
-                diff_temp = diff_temp + fabs(new - old); /* Calculate the difference in values. */
-                element_count++;
-            }
+        float *src = grid_2->element; /* Buffers may only be swapped inside the barrier */
+        float *dst = grid_temp->element;
+        int check = pipelined_check || ((total_iter + 1) % check_interval) == 0;
 
-            //Update after each row
-            barrier_sync (&barrier); /* Wait here for all threads at the end of each row */  
+        trace_event (parameter->thread_idx - 1, TRACE_SWEEP_BEGIN);
+
+        if (snapshot != NULL) {
+            /* Copy this thread's share of the rows of the current grid into the checkpoint. */
+            int first = ((parameter->thread_idx - 1) * ny)/num_threads;
+            int last = (parameter->thread_idx * ny)/num_threads;
+            memcpy (&snapshot[first * stride], &src[first * stride], sizeof (float) * (last - first) * stride);
+        }
+
+        if (reproducible) {
+            /* A contiguous block of interior rows, each with its own residual slot */
+            int rows_per_plane = ny - 2;
+            int first = ((parameter->thread_idx - 1) * num_rows2)/num_threads;
+            int last = (parameter->thread_idx * num_rows2)/num_threads;
+            for (int r = first; r < last; r++) {
+                size_t row = ((nz == 1) ? 0 : (1 + r / rows_per_plane) * plane) + (1 + r % rows_per_plane) * stride;
+                double row_diff = 0.0;
+                for (int j = 1; j < (nx - 1); j++) {
+                    size_t idx = row + j;
+                    old = src[idx]; /* Store old value of grid point. */
+                    /* Apply the update rule. */
+                    if (nz == 1)
+                        new = 0.25 * (src[idx - stride] +\
+                                      src[idx + stride] +\
+                                      src[idx + 1] +\
+                                      src[idx - 1]);
+                    else
+                        new = (1.0/6.0) * (src[idx - plane] +\
+                                           src[idx + plane] +\
+                                           src[idx - stride] +\
+                                           src[idx + stride] +\
+                                           src[idx + 1] +\
+                                           src[idx - 1]);
+
+                    dst[idx] = new; /* Update the grid-point value. */
+                    row_diff = row_diff + fabs(new - old); /* Calculate the difference in values. */
+                }
+                row_diff2[total_iter & 1][r] = row_diff;
+            }
+        }
+        else if (nz == 1) {
+            for (int i = 1; i < (ny - 1); i++) {    
+                for ( int j = parameter->thread_idx; j < (nx - 1); j+= num_threads) {
+                    size_t idx = i * stride + j;
+                    old = src[idx]; /* Store old value of grid point. */
+                    /* Apply the update rule. */	
+                    new = 0.25 * (src[idx - stride] +\
+                                  src[idx + stride] +\
+                                  src[idx + 1] +\
+                                  src[idx - 1]);
+
+                    dst[idx] = new; /* Update the grid-point value. */
+                    if (check)
+                        diff_temp = diff_temp + fabs(new - old); /* Calculate the difference in values. */
+                }
+            }
+        }
+        else {
+            for (int k = 1; k < (nz - 1); k++) {
+                for (int i = 1; i < (ny - 1); i++) {
+                    for (int j = parameter->thread_idx; j < (nx - 1); j += num_threads) {
+                        size_t idx = k * plane + i * stride + j;
+                        old = src[idx]; /* Store old value of grid point. */
+                        /* Apply the update rule. */
+                        new = (1.0/6.0) * (src[idx - plane] +\
+                                           src[idx + plane] +\
+                                           src[idx - stride] +\
+                                           src[idx + stride] +\
+                                           src[idx + 1] +\
+                                           src[idx - 1]);
+
+                        dst[idx] = new; /* Update the grid-point value. */
+                        if (check)
+                            diff_temp = diff_temp + fabs(new - old); /* Calculate the difference in values. */
+                    }
+                }
+            }
         }
-        num_elements2+=element_count;
-        diff2 += diff_temp;
-        printf ("diff %f element_count %d at the end of iteration of Thread %d\n", diff2, element_count , parameter->thread_idx);        
-        barrier_sync (&barrier); /* Wait here for all threads at the end of each iteration */
+        parameter->diff[total_iter & 1] = diff_temp;
+
+        /* Test the previous iteration while the others are still computing this one. Its slots were
+         * all written before the last barrier, and this iteration writes the other slot. */
+        if (pipelined_check && parameter->thread_idx == 1 && total_iter > 0)
+            converged2 = check_convergence (total_iter - 1);
+
+        trace_event (parameter->thread_idx - 1, TRACE_SWEEP_END);
+        trace_event (parameter->thread_idx - 1, TRACE_BARRIER_ARRIVE);
+        barrier_sync (&barrier, end_of_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+        trace_event (parameter->thread_idx - 1, TRACE_BARRIER_DEPART);
     }
 
     pthread_exit (NULL);
 }
 
-/* The function that implements the barrier synchronization. */
+/* Sum the per-thread residuals of an iteration and test them against eps. */
+int 
+check_convergence (int iter)
+{
+    double diff = 0.0;
+
+    if (reproducible)
+        diff = pairwise_sum (row_diff2[iter & 1], num_rows2);
+    else
+        for (int i = 0; i < num_threads; i++)
+            diff += jacobi_args[i].diff[iter & 1];
+    diff = diff/num_elements2;
+    last_diff = diff;
+    printf ("Iteration %d. DIFF: %f. Num_element: %zu\n", iter, diff, num_elements2);
+    return diff < eps;
+}
+
+/* Sum n values by recursive halving. The order of the additions depends only on n. */
+static double
+pairwise_sum (const double *x, int n)
+{
+    double sum = 0.0;
+
+    if (n <= 8) {
+        for (int i = 0; i < n; i++)
+            sum += x[i];
+        return sum;
+    }
+    return pairwise_sum (x, n/2) + pairwise_sum (x + n/2, n - n/2);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence, swaps the two grid buffers, and
+ * starts or completes a checkpoint. A checkpoint of the grid after iteration i is copied by the threads while 
+ * they compute iteration i + 1 and handed to the background flush thread at the end of it. */
 void 
-barrier_sync (BARRIER *barrier)
+end_of_iteration (void *arg)
 {
-    sem_wait (&(barrier->counter_sem)); /* Obtain the lock on the counter */
-
-    /* Check if all threads before us, that is NUM_THREADS-1 threads have reached this point */
-    if (barrier->counter == (num_threads - 1)) {
-        if (barrier->row_count < grid_2->dim-2)
-        {
-            /*Parse temporary grid to original grid_2 to start new row*/
-            free ((void *) grid_2->element);	
-	        free ((void *) grid_2);
-            grid_2 = copy_grid(grid_temp);
-            // for ( int j = 1; j < (grid_2->dim - 1); j++) {
-            //     grid_2->element[(barrier->row_count+1) * grid_2->dim + j] = grid_temp->element[(barrier->row_count+1) * grid_2->dim + j];
-            // }
-            barrier->counter = 0; /* Reset the counter */    
-            barrier->row_count += 1;
-            /* Signal the blocked threads that it is now safe to cross the barrier */			 
-            sem_post (&(barrier->counter_sem)); 
-            for (int i = 0; i < (num_threads-1); i++)
-                sem_post (&(barrier->barrier_sem));
-        }
-        else //Last row reached. End of 1 iteration
-        {
-            /* Check for convergence after each iteration */
-            diff2 = diff2/num_elements2;
-            printf ("Iteration %d. DIFF: %f. Num_element: %d\n", total_iter, diff2, num_elements2);
-            total_iter++;
-            if (diff2 < eps){
-                done2 = 1;
-                // for (int i = 0; i < (num_threads-1); i++)
-                //     sem_post (&(barrier->barrier_sem));
-            }
-            
-            /*Reset after each iteration*/
-            diff2 = 0.0;
-            num_elements2 = 0;
-            free ((void *) grid_2->element);	
-	        free ((void *) grid_2);
-            grid_2 = copy_grid(grid_temp);
-            
-            // for ( int j = 1; j < (grid_2->dim - 1); j++) {
-            //      grid_2->element[(barrier->row_count+1) * grid_2->dim + j] = grid_temp->element[(barrier->row_count+1) * grid_2->dim + j];
-            // }
-            barrier->counter = 0; /* Reset the counter */
-            barrier->row_count = 0;
-            /* Signal the blocked threads that it is now safe to cross the barrier */			 
-            //printf ("here\n");
-            sem_post (&(barrier->counter_sem)); 
-            for (int i = 0; i < (num_threads-1); i++)
-                sem_post (&(barrier->barrier_sem));
+    float *temp;
+
+    if (snapshot != NULL) {
+        checkpoint_commit (&checkpoint, snapshot_iter, last_diff);
+        snapshot = NULL;
+    }
+
+    if (pipelined_check) {
+        if (converged2) {
+            /* The previous iteration converged; it is still in grid 2. Drop the one just computed. */
+            done2 = 1;
+            return;
         }
+    }
+    else if (((total_iter + 1) % check_interval) == 0 && check_convergence (total_iter))
+        done2 = 1;
+    total_iter++;
+    if (total_iter == max_iter)
+        done2 = 1;
         
-    } 
-    else {
-        barrier->counter++; // Increment the counter
-        sem_post (&(barrier->counter_sem)); // Release the lock on the counter
-        sem_wait (&(barrier->barrier_sem)); // Block on the barrier semaphore and wait for someone to signal us when it is safe to cross
+    /* Swap the buffers: the grid just written becomes the input of the next iteration. */
+    temp = grid_2->element;
+    grid_2->element = grid_temp->element;
+    grid_temp->element = temp;
+
+    if (checkpoint_path != NULL && !done2 && (total_iter % checkpoint_interval) == 0) {
+        snapshot = checkpoint_begin (&checkpoint); /* NULL if the previous checkpoint is still being written */
+        snapshot_iter = total_iter;
     }
 }
 
-
-/* Create a grid with the specified initial conditions. */
+/* Create a square 2-D grid with the specified initial conditions. */
 grid_t * 
 create_grid (int dim, float min, float max)
 {
-    grid_t *grid = (grid_t *) malloc (sizeof (grid_t));
+    return create_grid_3d (dim, dim, 1, min, max);
+}
+
+/* Create a grid of nz planes of ny rows of nx points, with heat applied to the north side, that is
+ * row 0 of every plane, and every other point at zero. */
+grid_t *
+create_grid_3d (int nx, int ny, int nz, float min, float max)
+{
+    if (nz == 1)
+        printf ("Creating a grid of dimension %d x %d\n", nx, ny);
+    else
+        printf ("Creating a grid of dimension %d x %d x %d\n", nx, ny, nz);
+    grid_t *grid = allocate_grid (nx, ny, nz); /* Zeroed */
     if (grid == NULL)
         return NULL;
 
-    grid->dim = dim;
-	printf("Creating a grid of dimension %d x %d\n", grid->dim, grid->dim);
-	grid->element = (float *) malloc (sizeof (float) * grid->dim * grid->dim);
-    if (grid->element == NULL)
+    /* Initialize the north side with temperature values. A 3-D grid leaves the edges where the
+     * north face meets the front and back faces at zero. */ 
+    srand ((unsigned) time (NULL));
+	float val;		
+    int k, j;
+    int k_first = (nz == 1) ? 0 : 1;
+    int k_last = (nz == 1) ? 1 : nz - 1;
+    for (k = k_first; k < k_last; k++) {
+        for (j = 1; j < (nx - 1); j++) {
+            val =  min + (max - min) * rand ()/(float)RAND_MAX;
+            grid->element[GRID_INDEX (grid, k, 0, j)] = val; 	
+        }
+    }
+
+    return grid;
+}
+
+/* Allocate a zeroed grid of nz planes of ny rows of nx points. The rows are zeroed in parallel. */
+grid_t *
+allocate_grid (int nx, int ny, int nz)
+{
+    grid_t *grid = allocate_grid_layout (nx, ny, nz);
+    if (grid == NULL)
         return NULL;
 
-    int i, j;
-	for (i = 0; i < grid->dim; i++) {
-		for (j = 0; j < grid->dim; j++) {
-            grid->element[i * grid->dim + j] = 0.0; 			
-		}
-    }
+    parallel_zero_grid (grid, num_threads);
 
-    /* Initialize the north side, that is row 0, with temperature values. */ 
-    srand ((unsigned) time (NULL));
-	float val;		
-    for (j = 1; j < (grid->dim - 1); j++) {
-        val =  min + (max - min) * rand ()/(float)RAND_MAX;
-        grid->element[j] = val; 	
+    return grid;
+}
+
+/* Allocate a grid without touching its elements. Each row is padded to a multiple of GRID_ALIGN
+ * bytes and the elements are aligned to GRID_ALIGN. */
+static grid_t *
+allocate_grid_layout (int nx, int ny, int nz)
+{
+    grid_t *grid = (grid_t *) malloc (sizeof (grid_t));
+    if (grid == NULL)
+        return NULL;
+
+    grid->dim = (nx == ny && nz == 1) ? nx : 0;
+    grid->nx = nx;
+    grid->ny = ny;
+    grid->nz = nz;
+    grid->stride = (((size_t) nx * sizeof (float) + GRID_ALIGN - 1)/GRID_ALIGN) * (GRID_ALIGN/sizeof (float));
+    grid->plane = grid->stride * ny;
+    size_t size = sizeof (float) * grid->plane * nz;
+    if (posix_memalign ((void **) &grid->element, GRID_ALIGN, size) != 0) {
+        free ((void *) grid);
+        return NULL;
     }
 
     return grid;
@@ -294,37 +833,30 @@ create_grid (int dim, float min, float max)
 grid_t *
 copy_grid (grid_t *grid) 
 {
-    grid_t *new_grid = (grid_t *) malloc (sizeof (grid_t));
+    grid_t *new_grid = allocate_grid_layout (grid->nx, grid->ny, grid->nz);
     if (new_grid == NULL)
         return NULL;
 
-    new_grid->dim = grid->dim;
-	new_grid->element = (float *) malloc (sizeof (float) * new_grid->dim * new_grid->dim);
-    if (new_grid->element == NULL)
-        return NULL;
-
-    int i, j;
-	for (i = 0; i < new_grid->dim; i++) {
-		for (j = 0; j < new_grid->dim; j++) {
-            new_grid->element[i * new_grid->dim + j] = grid->element[i * new_grid->dim + j] ; 			
-		}
-    }
+    /* Same layout, so the padding is copied along with the rows. */
+    parallel_copy_grid (new_grid, grid, num_threads);
 
     return new_grid;
 }
 
-/* This function prints the grid on the screen. */
+/* This function prints the grid on the screen, one plane after the other. */
 void 
 print_grid (grid_t *grid)
 {
-    int i, j;
-    for (i = 0; i < grid->dim; i++) {
-        for (j = 0; j < grid->dim; j++) {
-            printf ("%f\t", grid->element[i * grid->dim + j]);
+    int i, j, k;
+    for (k = 0; k < grid->nz; k++) {
+        for (i = 0; i < grid->ny; i++) {
+            for (j = 0; j < grid->nx; j++) {
+                printf ("%f\t", grid->element[GRID_INDEX (grid, k, i, j)]);
+            }
+            printf ("\n");
         }
         printf ("\n");
     }
-    printf ("\n");
 }
 
 
@@ -332,25 +864,9 @@ print_grid (grid_t *grid)
 void 
 print_stats (grid_t *grid)
 {
-    float min = INFINITY;
-    float max = 0.0;
-    double sum = 0.0;
-    int num_elem = 0;
-    int i, j;
-
-    for (i = 1; i < (grid->dim - 1); i++) {
-        for (j = 1; j < (grid->dim - 1); j++) {
-            sum += grid->element[i * grid->dim + j];
-
-            if (grid->element[i * grid->dim + j] > max) 
-                max = grid->element[i * grid->dim + j];
-
-             if(grid->element[i * grid->dim + j] < min) 
-                min = grid->element[i * grid->dim + j];
-             
-             num_elem++;
-        }
-    }
+    float min, max;
+    double sum;
+    size_t num_elem = parallel_grid_stats (grid, num_threads, &min, &max, &sum);
                     
     printf("AVG: %f\n", sum/num_elem);
 	printf("MIN: %f\n", min);
@@ -358,21 +874,10 @@ print_stats (grid_t *grid)
 	printf("\n");
 }
 
-/* Calculate the mean squared error between elements of two grids. */
+/* Calculate the mean squared error between elements of two grids of the same shape. The padding at
+ * the end of each row is skipped. */
 double
 grid_mse (grid_t *grid_1, grid_t *grid_2)
 {
-    double mse = 0.0;
-    int num_elem = grid_1->dim * grid_1->dim;
-    int i;
-
-    for (i = 0; i < num_elem; i++) 
-        mse += (grid_1->element[i] - grid_2->element[i]) * (grid_1->element[i] - grid_2->element[i]);
-                   
-    return mse/num_elem; 
+    return parallel_grid_mse (grid_1, grid_2, num_threads);
 }
-
-
-
-		
-
@@ -0,0 +1,281 @@
+/* Asynchronous (chaotic) relaxation solver.
+ *
+ * Each thread owns a contiguous block of rows, copied into a private buffer with one halo row above
+ * and below, and relaxes it in place over and over using whatever neighbor values are current. There
+ * is no global barrier. After every sweep a thread publishes its first and last rows to its two
+ * neighbors through a halo: two row buffers, each with a sequence count, and a version counter. The
+ * writer fills the buffer the next version will point to and then releases the new version. Each
+ * buffer is a seqlock: the writer makes its sequence count odd before the copy and even again after
+ * it, and a reader copies the buffer of the version it loaded and retries if the count was odd or
+ * changed during the copy, because the writer was then reusing the buffer for a later version. A
+ * reader thus gets a whole row, of the version it loaded or a later one, never a torn one. Readers
+ * never block writers and only neighbors ever touch a halo.
+ *
+ * A halo's version is the number of sweeps its owner has completed, so it also bounds staleness: a
+ * thread that is more than MAX_STALENESS sweeps ahead of a neighbor yields until the neighbor catches
+ * up. Without the bound, a thread could sweep its block many times against the same halo (as happens
+ * when threads outnumber cores), which drives its local residual to zero without any global progress.
+ *
+ * Every thread also publishes the residual of its latest sweep. The calling thread acts as the
+ * convergence detector: it wakes up periodically and sums the residuals. Since a small local residual
+ * may have been computed against stale halos, convergence is only declared when the sum is below eps
+ * twice in a row, with every thread having completed another sweep in between. The detector then
+ * stops the workers, which copy their blocks back into the grid.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+
+#define CACHE_LINE 64
+#define DETECTOR_PERIOD 200000 /* Nanoseconds between two looks of the convergence detector */
+#define MAX_STALENESS 1 /* Sweeps a thread may run ahead of its neighbors */
+
+/* Row published by a thread for one of its neighbors */
+typedef struct halo_s {
+    float *row[2]; /* row[v & 1] holds the contents of version v */
+    unsigned long sequence[2]; /* Odd while row[k] is being written */
+    unsigned long version;
+} HALO;
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line. The halos, read
+ * by the neighbors, and the progress, read by the detector, are on separate lines. */
+typedef struct args_for_async_thread_t {
+    int thread_idx;
+    int start, end; /* Rows [start, end) of the grid */
+    HALO top; /* Row start, read by the thread above */
+    HALO bottom; /* Row end - 1, read by the thread below */
+    double diff __attribute__ ((aligned (CACHE_LINE))); /* Residual of the latest sweep */
+    unsigned long sweeps; /* Sweeps completed */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_ASYNC_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_ASYNC_THREAD) % CACHE_LINE == 0, "ARGS_FOR_ASYNC_THREAD must fill whole cache lines");
+
+/* Function prototypes */
+int compute_using_pthreads_async (grid_t *, int);
+static void *async_thread (void *);
+static void publish_row (HALO *, const float *, int);
+static void read_row (HALO *, float *, int, unsigned long *);
+static void wait_for_neighbor (HALO *, unsigned long);
+
+extern float eps;
+
+/* Shared variables */
+static grid_t *async_grid;
+static ARGS_FOR_ASYNC_THREAD *async_args;
+static int async_num_threads;
+static int async_done;
+
+int
+compute_using_pthreads_async (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    unsigned long *sweeps = (unsigned long *) malloc (sizeof (unsigned long) * num_threads);
+    unsigned long *candidate_sweeps = (unsigned long *) malloc (sizeof (unsigned long) * num_threads);
+    int dim = grid->dim;
+    int num_rows = dim - 2;
+    size_t num_elements = (size_t) num_rows * num_rows;
+    struct timespec period = {0, DETECTOR_PERIOD};
+    unsigned long min_sweeps, max_sweeps, total_sweeps;
+    int candidate = 0; /* The residual was below eps at the last look */
+    int i, k;
+
+    if (num_threads > num_rows)
+        num_threads = num_rows; /* Every thread needs at least one row to publish */
+    async_grid = grid;
+    async_num_threads = num_threads;
+    async_done = 0;
+
+    if (posix_memalign ((void **) &async_args, CACHE_LINE, sizeof (ARGS_FOR_ASYNC_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        ARGS_FOR_ASYNC_THREAD *args = &async_args[i];
+        args->thread_idx = i;
+        args->start = 1 + (i * num_rows)/num_threads;
+        args->end = 1 + ((i + 1) * num_rows)/num_threads;
+        args->diff = 0.0;
+        args->sweeps = 0;
+        for (k = 0; k < 2; k++) {
+            args->top.row[k] = (float *) malloc (sizeof (float) * dim);
+            args->bottom.row[k] = (float *) malloc (sizeof (float) * dim);
+        }
+        /* Version 0 is the initial grid. */
+        memcpy (args->top.row[0], &grid->element[args->start * grid->stride], sizeof (float) * dim);
+        memcpy (args->bottom.row[0], &grid->element[(args->end - 1) * grid->stride], sizeof (float) * dim);
+        args->top.version = 0;
+        args->bottom.version = 0;
+        for (k = 0; k < 2; k++) {
+            args->top.sequence[k] = 0;
+            args->bottom.sequence[k] = 0;
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if ((pthread_create (&thread_id[i], NULL, async_thread, (void *) &async_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    /* Convergence detector */
+    while (!async_done) {
+        double diff = 0.0, d;
+        int progressed = 1;
+
+        nanosleep (&period, NULL);
+        for (i = 0; i < num_threads; i++) {
+            sweeps[i] = __atomic_load_n (&async_args[i].sweeps, __ATOMIC_ACQUIRE);
+            __atomic_load (&async_args[i].diff, &d, __ATOMIC_RELAXED);
+            if (sweeps[i] == 0 || (candidate && sweeps[i] == candidate_sweeps[i]))
+                progressed = 0;
+            diff += d;
+        }
+        if (!progressed)
+            continue; /* Wait until every thread has swept again since the candidate look */
+
+        diff = diff/num_elements;
+        if (diff < eps && candidate)
+            __atomic_store_n (&async_done, 1, __ATOMIC_RELEASE);
+        candidate = (diff < eps);
+        if (candidate) /* Later looks count sweeps from this one */
+            for (i = 0; i < num_threads; i++)
+                candidate_sweeps[i] = sweeps[i];
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    min_sweeps = max_sweeps = async_args[0].sweeps;
+    total_sweeps = 0;
+    for (i = 0; i < num_threads; i++) {
+        if (async_args[i].sweeps < min_sweeps)
+            min_sweeps = async_args[i].sweeps;
+        if (async_args[i].sweeps > max_sweeps)
+            max_sweeps = async_args[i].sweeps;
+        total_sweeps += async_args[i].sweeps;
+        for (k = 0; k < 2; k++) {
+            free ((void *) async_args[i].top.row[k]);
+            free ((void *) async_args[i].bottom.row[k]);
+        }
+    }
+    printf ("Sweeps per thread: min %lu, max %lu\n", min_sweeps, max_sweeps);
+
+    free ((void *) async_args);
+    free ((void *) sweeps);
+    free ((void *) candidate_sweeps);
+    free ((void *) thread_id);
+
+    return (int) (total_sweeps/num_threads);
+}
+
+/* The function executed by the threads. */
+static void *
+async_thread (void *thread_parameter)
+{
+    ARGS_FOR_ASYNC_THREAD *parameter = (ARGS_FOR_ASYNC_THREAD *) thread_parameter;
+    int dim = async_grid->dim;
+    size_t stride = async_grid->stride;
+    int rows = parameter->end - parameter->start;
+    HALO *above = (parameter->thread_idx > 0) ? &async_args[parameter->thread_idx - 1].bottom : NULL;
+    HALO *below = (parameter->thread_idx < async_num_threads - 1) ? &async_args[parameter->thread_idx + 1].top : NULL;
+    unsigned long seen_above = 0, seen_below = 0;
+    float old, new;
+    int i, j;
+
+    /* Private copy of the block, in the layout of the grid; local row 0 and rows + 1 are the halos. */
+    float *block = (float *) malloc (sizeof (float) * (rows + 2) * stride);
+    memcpy (block, &async_grid->element[(parameter->start - 1) * stride], sizeof (float) * (rows + 2) * stride);
+
+    while (!__atomic_load_n (&async_done, __ATOMIC_ACQUIRE)) {
+        double diff = 0.0;
+
+        if (above != NULL)
+            wait_for_neighbor (above, parameter->sweeps);
+        if (below != NULL)
+            wait_for_neighbor (below, parameter->sweeps);
+        if (above != NULL)
+            read_row (above, &block[0], dim, &seen_above);
+        if (below != NULL)
+            read_row (below, &block[(rows + 1) * stride], dim, &seen_below);
+
+        for (i = 1; i <= rows; i++) {
+            for (j = 1; j < (dim - 1); j++) {
+                old = block[i * stride + j];
+                new = 0.25 * (block[(i - 1) * stride + j] + block[(i + 1) * stride + j] +\
+                              block[i * stride + (j + 1)] + block[i * stride + (j - 1)]);
+                block[i * stride + j] = new;
+                diff += fabs (new - old);
+            }
+        }
+
+        publish_row (&parameter->top, &block[stride], dim);
+        publish_row (&parameter->bottom, &block[rows * stride], dim);
+        __atomic_store (&parameter->diff, &diff, __ATOMIC_RELAXED);
+        __atomic_store_n (&parameter->sweeps, parameter->sweeps + 1, __ATOMIC_RELEASE);
+    }
+
+    memcpy (&async_grid->element[parameter->start * stride], &block[stride], sizeof (float) * rows * stride);
+    free ((void *) block);
+    pthread_exit (NULL);
+}
+
+/* Publish a new version of a halo row. Only the owning thread writes a halo. */
+static void
+publish_row (HALO *halo, const float *row, int dim)
+{
+    unsigned long version = halo->version + 1;
+    unsigned long *sequence = &halo->sequence[version & 1];
+
+    /* The odd count must be visible before any of the row is overwritten. */
+    __atomic_store_n (sequence, *sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (halo->row[version & 1], row, sizeof (float) * dim);
+    __atomic_store_n (sequence, *sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n (&halo->version, version, __ATOMIC_RELEASE);
+}
+
+/* Yield until a neighbor has completed at least sweeps - MAX_STALENESS sweeps. */
+static void
+wait_for_neighbor (HALO *halo, unsigned long sweeps)
+{
+    while (__atomic_load_n (&halo->version, __ATOMIC_ACQUIRE) + MAX_STALENESS < sweeps) {
+        if (__atomic_load_n (&async_done, __ATOMIC_ACQUIRE))
+            return;
+        sched_yield ();
+    }
+}
+
+/* Copy the latest version of a neighbor's halo row into row, if it is newer than *seen. */
+static void
+read_row (HALO *halo, float *row, int dim, unsigned long *seen)
+{
+    unsigned long version, sequence, check;
+
+    for (;;) {
+        version = __atomic_load_n (&halo->version, __ATOMIC_ACQUIRE);
+        if (version == *seen)
+            return;
+        sequence = __atomic_load_n (&halo->sequence[version & 1], __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+            continue; /* The writer is already reusing the buffer */
+        memcpy (row, halo->row[version & 1], sizeof (float) * dim);
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        check = __atomic_load_n (&halo->sequence[version & 1], __ATOMIC_RELAXED);
+        if (check == sequence) { /* The buffer was not written while we copied it */
+            *seen = version;
+            return;
+        }
+    }
+}
@@ -0,0 +1,373 @@
+/* Batch solver for many independent plates.
+ *
+ * The plates are read from a file with one plate per line, "dim min-temp max-temp"; blank lines
+ * and lines starting with # are skipped. Each plate gets the initial conditions of create_grid,
+ * from a seed derived from its line number, so a batch is reproducible.
+ *
+ * A small plate is solved from start to finish by one worker thread, with no synchronization
+ * between threads at all. Every worker has a deque of plates, dealt out largest first; it takes
+ * plates from the front of its own deque and, once that is empty, steals from the back of the
+ * others', so the workers stay busy until the last plate has been taken. Plates too big for one
+ * worker, whose two buffers exceed BATCH_SHARED_BYTES, are solved first, one at a time, by all the
+ * workers together: each takes a block of rows and they meet at a barrier after every iteration.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "stencil.h"
+
+#define CACHE_LINE 64
+#ifndef BATCH_SHARED_BYTES
+#define BATCH_SHARED_BYTES (8L * 1024 * 1024) /* Plates with larger buffers are solved by all workers; may be set with -D */
+#endif
+
+/* One plate of the batch and its result */
+typedef struct plate_s {
+    int line; /* Line of the spec file */
+    int dim;
+    float min, max;
+    int iterations;
+    double avg;
+} PLATE;
+
+/* Deque of plates owned by one worker. The owner takes from head, thieves from tail. */
+typedef struct deque_s {
+    pthread_mutex_t mutex;
+    int *plates; /* Indices into the plate list */
+    int head, tail; /* Plates [head, tail) are left */
+} DEQUE;
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_batch_thread_t {
+    int thread_idx;
+    int solved; /* Plates solved by this worker */
+    int stolen; /* Of which taken from other workers */
+    double diff; /* Residual of the rows of a shared plate */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_BATCH_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_BATCH_THREAD) == CACHE_LINE, "ARGS_FOR_BATCH_THREAD must fill one cache line");
+
+/* Function prototypes */
+void solve_batch (const char *, int);
+static int read_plates (const char *, PLATE **);
+static grid_t *create_plate (PLATE *);
+static void finish_plate (PLATE *, grid_t *, int);
+static int by_size (const void *, const void *);
+static int take_plate (int, int *);
+static void *batch_thread (void *);
+static void end_of_shared_iteration (void *);
+static double sweep_rows (const float *, float *, size_t, int, int, int);
+
+extern float eps;
+extern grid_t *allocate_grid (int, int, int);
+extern grid_t *copy_grid (grid_t *);
+
+/* Shared variables */
+static PLATE *plates;
+static DEQUE *deques;
+static ARGS_FOR_BATCH_THREAD *batch_args;
+static int batch_num_threads;
+static BARRIER batch_barrier; /* Iterations of a shared plate, among the workers */
+static BARRIER handoff_barrier; /* End of a shared plate, between the workers and solve_batch */
+static grid_t *shared_grid; /* Plate being solved by all workers, if any */
+static grid_t *shared_temp;
+static int shared_iter;
+static int shared_done;
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shared_cond = PTHREAD_COND_INITIALIZER;
+static int shared_generation; /* Incremented when a shared plate is posted, or when there are no more */
+
+void
+solve_batch (const char *path, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int num_plates = read_plates (path, &plates);
+    int *order = (int *) malloc (sizeof (int) * (num_plates + 1));
+    int num_shared = 0;
+    struct timeval start, stop;
+    double seconds;
+    int i, k;
+
+    printf ("Solving %d plates from %s with %d threads\n", num_plates, path, num_threads);
+    gettimeofday (&start, NULL);
+
+    /* Largest plates first: they go to the workers first, and big ones are shared. */
+    for (i = 0; i < num_plates; i++)
+        order[i] = i;
+    qsort (order, num_plates, sizeof (int), by_size);
+    while (num_shared < num_plates && 2 * sizeof (float) * (size_t) plates[order[num_shared]].dim * plates[order[num_shared]].dim > BATCH_SHARED_BYTES)
+        num_shared++;
+
+    /* Deal the other plates round robin, so every deque has a similar mix of sizes. */
+    batch_num_threads = num_threads;
+    deques = (DEQUE *) malloc (sizeof (DEQUE) * num_threads);
+    for (i = 0; i < num_threads; i++) {
+        pthread_mutex_init (&deques[i].mutex, NULL);
+        deques[i].plates = (int *) malloc (sizeof (int) * (num_plates/num_threads + 1));
+        deques[i].head = deques[i].tail = 0;
+    }
+    for (k = num_shared; k < num_plates; k++) {
+        DEQUE *deque = &deques[(k - num_shared) % num_threads];
+        deque->plates[deque->tail++] = order[k];
+    }
+
+    if (posix_memalign ((void **) &batch_args, CACHE_LINE, sizeof (ARGS_FOR_BATCH_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    barrier_init (&batch_barrier, num_threads);
+    barrier_init (&handoff_barrier, num_threads + 1);
+    shared_generation = 0;
+    for (i = 0; i < num_threads; i++) {
+        batch_args[i].thread_idx = i;
+        batch_args[i].solved = 0;
+        batch_args[i].stolen = 0;
+        if ((pthread_create (&thread_id[i], NULL, batch_thread, (void *) &batch_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    /* Post the shared plates one at a time; the workers return to the barrier when done with each. */
+    for (k = 0; k <= num_shared; k++) {
+        pthread_mutex_lock (&shared_mutex);
+        shared_grid = (k < num_shared) ? create_plate (&plates[order[k]]) : NULL;
+        if (shared_grid != NULL)
+            shared_temp = copy_grid (shared_grid);
+        shared_iter = 0;
+        shared_done = 0;
+        shared_generation++;
+        pthread_cond_broadcast (&shared_cond);
+        pthread_mutex_unlock (&shared_mutex);
+        if (shared_grid == NULL)
+            break;
+        barrier_sync (&handoff_barrier, NULL, NULL); /* Joined by the workers when the plate has converged */
+        finish_plate (&plates[order[k]], shared_grid, shared_iter);
+        free ((void *) shared_temp->element);
+        free ((void *) shared_temp);
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+    gettimeofday (&stop, NULL);
+    seconds = stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/1000000.0;
+
+    for (i = 0; i < num_plates; i++)
+        printf ("Line %d: %d x %d, %f to %f, %d iterations, AVG: %f\n", plates[i].line, plates[i].dim, plates[i].dim,
+                plates[i].min, plates[i].max, plates[i].iterations, plates[i].avg);
+    for (i = 0; i < num_threads; i++)
+        printf ("Thread %d: %d plates, %d stolen\n", i, batch_args[i].solved, batch_args[i].stolen);
+    printf ("%d plates (%d shared) in %fs: %.2f plates/s\n", num_plates, num_shared, seconds, num_plates/seconds);
+
+    barrier_destroy (&batch_barrier);
+    barrier_destroy (&handoff_barrier);
+    for (i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy (&deques[i].mutex);
+        free ((void *) deques[i].plates);
+    }
+    free ((void *) deques);
+    free ((void *) batch_args);
+    free ((void *) order);
+    free ((void *) plates);
+    free ((void *) thread_id);
+}
+
+/* Read the plate specs in path. Returns the number of plates. */
+static int
+read_plates (const char *path, PLATE **list)
+{
+    FILE *file = fopen (path, "r");
+    char line[256];
+    int num_plates = 0, capacity = 64, line_num = 0;
+    PLATE plate;
+
+    if (file == NULL) {
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    *list = (PLATE *) malloc (sizeof (PLATE) * capacity);
+    while (fgets (line, sizeof (line), file) != NULL) {
+        char *p = line + strspn (line, " \t");
+        line_num++;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        if (sscanf (p, "%d %f %f", &plate.dim, &plate.min, &plate.max) != 3 || plate.dim < 3) {
+            fprintf (stderr, "%s:%d: expected dim min-temp max-temp\n", path, line_num);
+            exit (EXIT_FAILURE);
+        }
+        plate.line = line_num;
+        if (num_plates == capacity) {
+            capacity *= 2;
+            *list = (PLATE *) realloc (*list, sizeof (PLATE) * capacity);
+        }
+        (*list)[num_plates++] = plate;
+    }
+    fclose (file);
+
+    if (num_plates == 0) {
+        fprintf (stderr, "%s: no plates\n", path);
+        exit (EXIT_FAILURE);
+    }
+    return num_plates;
+}
+
+/* Create the grid of a plate, with the initial conditions of create_grid. */
+static grid_t *
+create_plate (PLATE *plate)
+{
+    grid_t *grid = allocate_grid (plate->dim, plate->dim, 1);
+    unsigned int seed = (unsigned int) plate->line;
+    int j;
+
+    if (grid == NULL) {
+        perror ("allocate_grid");
+        exit (EXIT_FAILURE);
+    }
+    for (j = 1; j < (plate->dim - 1); j++)
+        grid->element[j] = plate->min + (plate->max - plate->min) * rand_r (&seed)/(float) RAND_MAX;
+    return grid;
+}
+
+/* Record the result of a plate and free its grid. */
+static void
+finish_plate (PLATE *plate, grid_t *grid, int iterations)
+{
+    double sum = 0.0;
+    int i, j;
+
+    for (i = 1; i < (grid->dim - 1); i++)
+        for (j = 1; j < (grid->dim - 1); j++)
+            sum += grid->element[i * grid->stride + j];
+    plate->iterations = iterations;
+    plate->avg = sum/((double) (grid->dim - 2) * (grid->dim - 2));
+    free ((void *) grid->element);
+    free ((void *) grid);
+}
+
+/* Order plate indices by decreasing dimension. */
+static int
+by_size (const void *a, const void *b)
+{
+    return plates[*(const int *) b].dim - plates[*(const int *) a].dim;
+}
+
+/* Take the next plate for a worker: from the front of its own deque, or else from the back of
+ * another one. Returns 0 once every deque is empty. */
+static int
+take_plate (int thread_idx, int *plate)
+{
+    int i, victim, found = 0;
+
+    for (i = 0; i < batch_num_threads && !found; i++) {
+        victim = (thread_idx + i) % batch_num_threads;
+        DEQUE *deque = &deques[victim];
+        pthread_mutex_lock (&deque->mutex);
+        if (deque->head < deque->tail) {
+            *plate = (i == 0) ? deque->plates[deque->head++] : deque->plates[--deque->tail];
+            found = 1;
+            if (i > 0)
+                batch_args[thread_idx].stolen++;
+        }
+        pthread_mutex_unlock (&deque->mutex);
+    }
+    return found;
+}
+
+/* The function executed by the threads. A worker first helps with the shared plates, then solves
+ * the small plates one by one. */
+static void *
+batch_thread (void *thread_parameter)
+{
+    ARGS_FOR_BATCH_THREAD *parameter = (ARGS_FOR_BATCH_THREAD *) thread_parameter;
+    int generation = 0;
+    int index;
+
+    for (;;) {
+        pthread_mutex_lock (&shared_mutex);
+        while (shared_generation == generation)
+            pthread_cond_wait (&shared_cond, &shared_mutex);
+        generation = shared_generation;
+        pthread_mutex_unlock (&shared_mutex);
+        if (shared_grid == NULL)
+            break;
+
+        /* Rows [start, end) of the shared plate */
+        int num_rows = shared_grid->dim - 2;
+        int start = 1 + (parameter->thread_idx * num_rows)/batch_num_threads;
+        int end = 1 + ((parameter->thread_idx + 1) * num_rows)/batch_num_threads;
+        while (!shared_done) {
+            /* Buffers may only be swapped inside the barrier */
+            parameter->diff = sweep_rows (shared_grid->element, shared_temp->element, shared_grid->stride, shared_grid->dim, start, end);
+            barrier_sync (&batch_barrier, end_of_shared_iteration, NULL);
+        }
+        barrier_sync (&handoff_barrier, NULL, NULL); /* Hand the plate back to solve_batch */
+    }
+
+    while (take_plate (parameter->thread_idx, &index)) {
+        grid_t *grid = create_plate (&plates[index]);
+        grid_t *temp = copy_grid (grid);
+        size_t num_elements = (size_t) (grid->dim - 2) * (grid->dim - 2);
+        int iterations = 0;
+        double diff;
+        float *swap;
+
+        do {
+            diff = sweep_rows (grid->element, temp->element, grid->stride, grid->dim, 1, grid->dim - 1)/num_elements;
+            iterations++;
+            swap = grid->element;
+            grid->element = temp->element;
+            temp->element = swap;
+        } while (diff >= eps);
+
+        finish_plate (&plates[index], grid, iterations);
+        free ((void *) temp->element);
+        free ((void *) temp);
+        parameter->solved++;
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks the shared plate for convergence and
+ * swaps its buffers. */
+static void
+end_of_shared_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (shared_grid->dim - 2) * (shared_grid->dim - 2);
+    double diff = 0.0;
+    float *temp;
+    int i;
+
+    for (i = 0; i < batch_num_threads; i++)
+        diff += batch_args[i].diff;
+    diff = diff/num_elements;
+    shared_iter++;
+    if (diff < eps)
+        shared_done = 1;
+
+    temp = shared_grid->element;
+    shared_grid->element = shared_temp->element;
+    shared_temp->element = temp;
+}
+
+/* One jacobi iteration over rows [start, end) of a dim x dim grid. Returns the sum of |new - old|. */
+static double
+sweep_rows (const float *src, float *dst, size_t stride, int dim, int start, int end)
+{
+    double diff = 0.0;
+    int i;
+
+    for (i = start; i < end; i++)
+        diff += stencil_relax_row (&stencil_5point, &src[i * stride], &dst[i * stride], stride, NULL, NULL, 1, dim - 1);
+    return diff;
+}
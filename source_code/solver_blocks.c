@@ -0,0 +1,196 @@
+/* Jacobi solver with a 2-D block decomposition.
+ *
+ * The interior is cut into a grid of thread_rows x thread_cols rectangular blocks and each thread
+ * owns one block. A thread only reads points of other blocks along its four edges, so the data
+ * shared between threads grows with the perimeter of the blocks rather than their area: with p
+ * threads on an n x n interior, row blocks exchange about 2 n (p - 1) points per iteration, square
+ * blocks about 2 n (sqrt (p) - 1).
+ *
+ * The block shape is chosen from dim and num_threads: among the factorizations num_threads =
+ * thread_rows * thread_cols, the one with the smallest total cut length is used, which is the most
+ * square one. A vertical cut shares at most one cache line per row between the two threads on
+ * either side, against every line of the row for the column-cyclic layout. A prime number of
+ * threads degenerates to one-dimensional strips.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "trace.h"
+
+#define CACHE_LINE 64
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_block_thread_t {
+    int thread_idx;
+    int row_start, row_end; /* Rows [row_start, row_end) of the grid */
+    int col_start, col_end; /* Columns [col_start, col_end) of the grid */
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_BLOCK_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_BLOCK_THREAD) == CACHE_LINE, "ARGS_FOR_BLOCK_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_jacobi_blocks (grid_t *, int);
+static void choose_block_shape (int, int, int *, int *);
+static void *block_thread (void *);
+static void end_of_block_iteration (void *);
+
+extern float eps;
+extern int max_iter;
+extern grid_t *copy_grid (grid_t *);
+
+/* Shared variables */
+static grid_t *block_grid;
+static grid_t *block_temp;
+static ARGS_FOR_BLOCK_THREAD *block_args;
+static BARRIER block_barrier;
+static int block_num_threads;
+static int block_iter;
+static int block_done;
+
+int
+compute_using_pthreads_jacobi_blocks (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int num_rows = grid->dim - 2;
+    int thread_rows, thread_cols;
+    int i;
+
+    choose_block_shape (num_rows, num_threads, &thread_rows, &thread_cols);
+    printf ("Blocks: %d x %d threads\n", thread_rows, thread_cols);
+
+    block_grid = grid;
+    block_temp = copy_grid (grid); /* Second buffer, swapped with the grid each iteration */
+    block_num_threads = num_threads;
+    block_iter = 0;
+    block_done = 0;
+    barrier_init (&block_barrier, num_threads);
+
+    if (posix_memalign ((void **) &block_args, CACHE_LINE, sizeof (ARGS_FOR_BLOCK_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        ARGS_FOR_BLOCK_THREAD *args = &block_args[i];
+        int r = i / thread_cols;
+        int c = i % thread_cols;
+
+        args->thread_idx = i;
+        args->row_start = 1 + (r * num_rows)/thread_rows;
+        args->row_end = 1 + ((r + 1) * num_rows)/thread_rows;
+        args->col_start = 1 + (c * num_rows)/thread_cols;
+        args->col_end = 1 + ((c + 1) * num_rows)/thread_cols;
+        if ((pthread_create (&thread_id[i], NULL, block_thread, (void *) args)) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    barrier_destroy (&block_barrier);
+    free ((void *) block_temp->element);
+    free ((void *) block_temp);
+    free ((void *) block_args);
+    free ((void *) thread_id);
+
+    return block_iter;
+}
+
+/* Factor num_threads into thread_rows * thread_cols blocks over an n x n interior, minimizing
+ * the total length of the cuts, (thread_rows - 1) * n + (thread_cols - 1) * n. Blocks must be at
+ * least one point wide; if no factorization fits, the extra threads get empty blocks. */
+static void
+choose_block_shape (int n, int num_threads, int *thread_rows, int *thread_cols)
+{
+    int best = -1;
+    int r, c;
+
+    *thread_rows = num_threads;
+    *thread_cols = 1;
+    for (r = 1; r <= num_threads; r++) {
+        if (num_threads % r != 0)
+            continue;
+        c = num_threads / r;
+        if (r > n || c > n)
+            continue;
+        if (best < 0 || r + c < best) {
+            best = r + c;
+            *thread_rows = r;
+            *thread_cols = c;
+        }
+    }
+}
+
+/* The function executed by the threads. Each thread reads the current buffer and writes its
+ * block of the next one. */
+static void *
+block_thread (void *thread_parameter)
+{
+    ARGS_FOR_BLOCK_THREAD *parameter = (ARGS_FOR_BLOCK_THREAD *) thread_parameter;
+    size_t stride = block_grid->stride;
+    float old, new;
+    int i, j;
+
+    while (!block_done) {
+        const float *src = block_grid->element; /* Buffers may only be swapped inside the barrier */
+        float *dst = block_temp->element;
+        double diff = 0.0;
+
+        trace_event (parameter->thread_idx, TRACE_SWEEP_BEGIN);
+
+        for (i = parameter->row_start; i < parameter->row_end; i++) {
+            for (j = parameter->col_start; j < parameter->col_end; j++) {
+                old = src[i * stride + j]; /* Store old value of grid point. */
+                /* Apply the update rule. */
+                new = 0.25 * (src[(i - 1) * stride + j] +\
+                              src[(i + 1) * stride + j] +\
+                              src[i * stride + (j + 1)] +\
+                              src[i * stride + (j - 1)]);
+
+                dst[i * stride + j] = new; /* Update the grid-point value. */
+                diff = diff + fabs (new - old); /* Calculate the difference in values. */
+            }
+        }
+
+        parameter->diff = diff;
+        trace_event (parameter->thread_idx, TRACE_SWEEP_END);
+        trace_event (parameter->thread_idx, TRACE_BARRIER_ARRIVE);
+        barrier_sync (&block_barrier, end_of_block_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+        trace_event (parameter->thread_idx, TRACE_BARRIER_DEPART);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence and swaps the two buffers. */
+static void
+end_of_block_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (block_grid->dim - 2) * (block_grid->dim - 2);
+    double diff = 0.0;
+    float *temp;
+    int i;
+
+    for (i = 0; i < block_num_threads; i++)
+        diff += block_args[i].diff;
+    diff = diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", block_iter, diff);
+    block_iter++;
+    if (diff < eps || block_iter == max_iter)
+        block_done = 1;
+
+    temp = block_grid->element;
+    block_grid->element = block_temp->element;
+    block_temp->element = temp;
+}
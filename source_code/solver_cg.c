@@ -0,0 +1,297 @@
+/* Preconditioned conjugate gradient solver.
+ *
+ * The interior points satisfy A u = b, where A u = 4 u - (N + S + E + W) over the interior and b holds
+ * the contributions of the fixed boundary. A is never stored: it is applied directly to grids that
+ * have the same layout as grid_t->element with zero boundaries. The residual r = b - A u is kept
+ * up to date by the iteration, and since r / 4 is exactly the change a jacobi sweep would make, the
+ * convergence test is the same as for the jacobi solver: mean |r| / 4 < eps.
+ *
+ * Two preconditioners are available. The jacobi preconditioner divides by the diagonal, which is the
+ * constant 4 here, so it gives the same iterates as plain CG. The symmetric Gauss-Seidel preconditioner
+ * applies one forward and one backward sweep in red-black order starting from zero, which reduces to
+ * three half-sweeps: red z = r/4, black z = (r + sum of z)/4, red z = (r + sum of z)/4.
+ *
+ * Each thread owns a contiguous block of rows. Dot products are accumulated into per-thread slots,
+ * aligned to a cache line, and summed by the last thread to reach the barrier.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+
+#define PRECOND_JACOBI 0
+#define PRECOND_SGS 1
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_cg_thread_t {
+    int thread_idx;
+    double dot; /* Partial dot product */
+    double diff; /* Partial sum of |r| */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_CG_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_CG_THREAD) == CACHE_LINE, "ARGS_FOR_CG_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_cg (grid_t *, int);
+int compute_using_pthreads_cg_sgs (grid_t *, int);
+static int cg_solve (grid_t *, int, int);
+static void *cg_thread (void *);
+static void compute_initial_rz (void *);
+static void compute_alpha (void *);
+static void compute_beta (void *);
+static void precondition (int, int, int);
+static void sgs_half_sweep (int, int, int, int);
+
+extern float eps;
+
+/* Shared variables */
+static grid_t *cg_grid; /* Holds the iterate u */
+static float *r, *z, *p, *q; /* Residual, preconditioned residual, search direction, A p */
+static ARGS_FOR_CG_THREAD *cg_args;
+static BARRIER cg_barrier;
+static int cg_num_threads;
+static int cg_precond;
+static double rz; /* r . z of the current iteration */
+static double alpha, beta;
+static int cg_iter;
+static int cg_done;
+
+int
+compute_using_pthreads_cg (grid_t *grid, int num_threads)
+{
+    return cg_solve (grid, num_threads, PRECOND_JACOBI);
+}
+
+int
+compute_using_pthreads_cg_sgs (grid_t *grid, int num_threads)
+{
+    return cg_solve (grid, num_threads, PRECOND_SGS);
+}
+
+static int
+cg_solve (grid_t *grid, int num_threads, int precond)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    size_t num_points = grid->plane; /* The vectors have the layout of the grid */
+    int i;
+
+    cg_grid = grid;
+    r = (float *) calloc (num_points, sizeof (float));
+    z = (float *) calloc (num_points, sizeof (float));
+    p = (float *) calloc (num_points, sizeof (float));
+    q = (float *) calloc (num_points, sizeof (float));
+    if (r == NULL || z == NULL || p == NULL || q == NULL) {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+
+    cg_num_threads = num_threads;
+    cg_precond = precond;
+    cg_iter = 0;
+    cg_done = 0;
+    barrier_init (&cg_barrier, num_threads);
+
+    if (posix_memalign ((void **) &cg_args, CACHE_LINE, sizeof (ARGS_FOR_CG_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        cg_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, cg_thread, (void *) &cg_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    barrier_destroy (&cg_barrier);
+    free ((void *) cg_args);
+    free ((void *) r);
+    free ((void *) z);
+    free ((void *) p);
+    free ((void *) q);
+    free ((void *) thread_id);
+
+    return cg_iter;
+}
+
+/* The function executed by the threads. Each thread owns rows [start, end). */
+static void *
+cg_thread (void *thread_parameter)
+{
+    ARGS_FOR_CG_THREAD *parameter = (ARGS_FOR_CG_THREAD *) thread_parameter;
+    int dim = cg_grid->dim;
+    size_t stride = cg_grid->stride;
+    float *u = cg_grid->element;
+    int num_rows = dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/cg_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/cg_num_threads;
+    double dot, diff;
+    int i, j;
+    size_t k;
+
+    /* r = b - A u, computed from the grid including its boundary. */
+    for (i = start; i < end; i++)
+        for (j = 1; j < (dim - 1); j++)
+            r[i * stride + j] = (u[(i - 1) * stride + j] + u[(i + 1) * stride + j] + u[i * stride + (j + 1)] + u[i * stride + (j - 1)]) -\
+                             4.0 * u[i * stride + j];
+
+    precondition (parameter->thread_idx, start, end);
+    dot = 0.0;
+    for (i = start; i < end; i++) {
+        for (j = 1; j < (dim - 1); j++) {
+            k = i * stride + j;
+            p[k] = z[k];
+            dot += (double) r[k] * z[k];
+        }
+    }
+    parameter->dot = dot;
+    barrier_sync (&cg_barrier, compute_initial_rz, NULL);
+
+    while (!cg_done) {
+        /* q = A p and p . q */
+        dot = 0.0;
+        for (i = start; i < end; i++) {
+            for (j = 1; j < (dim - 1); j++) {
+                k = i * stride + j;
+                q[k] = 4.0 * p[k] - (p[k - stride] + p[k + stride] + p[k + 1] + p[k - 1]);
+                dot += (double) p[k] * q[k];
+            }
+        }
+        parameter->dot = dot;
+        barrier_sync (&cg_barrier, compute_alpha, NULL);
+
+        /* u += alpha p, r -= alpha q */
+        diff = 0.0;
+        for (i = start; i < end; i++) {
+            for (j = 1; j < (dim - 1); j++) {
+                k = i * stride + j;
+                u[k] += alpha * p[k];
+                r[k] -= alpha * q[k];
+                diff += fabs (r[k]);
+            }
+        }
+        precondition (parameter->thread_idx, start, end);
+
+        dot = 0.0;
+        for (i = start; i < end; i++)
+            for (j = 1; j < (dim - 1); j++)
+                dot += (double) r[i * stride + j] * z[i * stride + j];
+        parameter->dot = dot;
+        parameter->diff = diff;
+        barrier_sync (&cg_barrier, compute_beta, NULL);
+
+        /* p = z + beta p */
+        for (i = start; i < end; i++)
+            for (j = 1; j < (dim - 1); j++)
+                p[i * stride + j] = z[i * stride + j] + beta * p[i * stride + j];
+        barrier_sync (&cg_barrier, NULL, NULL); /* A p reads p of neighboring rows */
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier: r.z of the initial residual */
+static void
+compute_initial_rz (void *arg)
+{
+    int i;
+
+    rz = 0.0;
+    for (i = 0; i < cg_num_threads; i++)
+        rz += cg_args[i].dot;
+    if (rz == 0.0)
+        cg_done = 1; /* The initial guess is the solution */
+}
+
+/* Executed by the last thread to reach the barrier: alpha = r.z / p.q */
+static void
+compute_alpha (void *arg)
+{
+    double pq = 0.0;
+    int i;
+
+    for (i = 0; i < cg_num_threads; i++)
+        pq += cg_args[i].dot;
+    alpha = (pq != 0.0) ? rz/pq : 0.0;
+}
+
+/* Executed by the last thread to reach the barrier: checks for convergence and computes
+ * beta = r.z (new) / r.z (old). */
+static void
+compute_beta (void *arg)
+{
+    size_t num_elements = (size_t) (cg_grid->dim - 2) * (cg_grid->dim - 2);
+    double rz_new = 0.0;
+    double diff = 0.0;
+    int i;
+
+    for (i = 0; i < cg_num_threads; i++) {
+        rz_new += cg_args[i].dot;
+        diff += cg_args[i].diff;
+    }
+    beta = (rz != 0.0) ? rz_new/rz : 0.0;
+    rz = rz_new;
+
+    diff = 0.25 * diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", cg_iter, diff);
+    cg_iter++;
+    if (diff < eps || rz == 0.0)
+        cg_done = 1;
+}
+
+/* z = M^-1 r for rows [start, end). */
+static void
+precondition (int thread_idx, int start, int end)
+{
+    int dim = cg_grid->dim;
+    size_t stride = cg_grid->stride;
+    int i, j;
+
+    if (cg_precond == PRECOND_SGS) {
+        sgs_half_sweep (start, end, 0, 0);
+        barrier_sync (&cg_barrier, NULL, NULL);
+        sgs_half_sweep (start, end, 1, 1);
+        barrier_sync (&cg_barrier, NULL, NULL);
+        sgs_half_sweep (start, end, 0, 1);
+        return;
+    }
+
+    for (i = start; i < end; i++)
+        for (j = 1; j < (dim - 1); j++)
+            z[i * stride + j] = 0.25 * r[i * stride + j];
+}
+
+/* z = (r + neighbors) / 4 for the points of the given color in rows [start, end).
+ * The neighbors are ignored in the first half-sweep, where z starts from zero. */
+static void
+sgs_half_sweep (int start, int end, int color, int use_neighbors)
+{
+    int dim = cg_grid->dim;
+    size_t stride = cg_grid->stride;
+    int i, j;
+    size_t k;
+
+    for (i = start; i < end; i++) {
+        for (j = 1 + ((i + 1 + color) & 1); j < (dim - 1); j += 2) {
+            k = i * stride + j;
+            if (use_neighbors)
+                z[k] = 0.25 * (r[k] + z[k - stride] + z[k + stride] + z[k + 1] + z[k - 1]);
+            else
+                z[k] = 0.25 * r[k];
+        }
+    }
+}
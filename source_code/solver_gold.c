@@ -3,41 +3,70 @@
 #include <math.h>
 #include "grid.h"
 
-/* This function solves the Gauss-Seidel method on the CPU using a single thread. */
+/* This function solves the Gauss-Seidel method on the CPU using a single thread. A 2-D grid uses the
+ * 5-point stencil and a 3-D grid the 7-point stencil. */
 int 
 compute_gold (grid_t *grid)
 {
     int num_iter = 0;
 	int done = 0;
-    int i, j;
+    int i, j, k;
 	double diff;
 	float old, new; 
     float eps = 1e-2; /* Convergence criteria. */
-    int num_elements; 
+    size_t num_elements; 
+    size_t stride = grid->stride;
+    size_t plane = grid->plane;
+    float *element = grid->element;
+    size_t idx;
 	
 	while(!done) { /* While we have not converged yet. */
         diff = 0.0;
         num_elements = 0;
 
-        for (i = 1; i < (grid->dim - 1); i++) {
-            for (j = 1; j < (grid->dim - 1); j++) {
-                old = grid->element[i * grid->dim + j]; /* Store old value of grid point. */
-                /* Apply the update rule. */	
-                new = 0.25 * (grid->element[(i - 1) * grid->dim + j] +\
-                              grid->element[(i + 1) * grid->dim + j] +\
-                              grid->element[i * grid->dim + (j + 1)] +\
-                              grid->element[i * grid->dim + (j - 1)]);
+        if (grid->nz == 1) {
+            for (i = 1; i < (grid->ny - 1); i++) {
+                for (j = 1; j < (grid->nx - 1); j++) {
+                    idx = i * stride + j;
+                    old = element[idx]; /* Store old value of grid point. */
+                    /* Apply the update rule. */	
+                    new = 0.25 * (element[idx - stride] +\
+                                  element[idx + stride] +\
+                                  element[idx + 1] +\
+                                  element[idx - 1]);
 
-                grid->element[i * grid->dim + j] = new; /* Update the grid-point value. */
-                diff = diff + fabs(new - old); /* Calculate the difference in values. */
-                num_elements++;
+                    element[idx] = new; /* Update the grid-point value. */
+                    diff = diff + fabs(new - old); /* Calculate the difference in values. */
+                    num_elements++;
+                }
+            }
+        }
+        else {
+            for (k = 1; k < (grid->nz - 1); k++) {
+                for (i = 1; i < (grid->ny - 1); i++) {
+                    for (j = 1; j < (grid->nx - 1); j++) {
+                        idx = GRID_INDEX (grid, k, i, j);
+                        old = element[idx]; /* Store old value of grid point. */
+                        /* Apply the update rule. */
+                        new = (1.0/6.0) * (element[idx - plane] +\
+                                           element[idx + plane] +\
+                                           element[idx - stride] +\
+                                           element[idx + stride] +\
+                                           element[idx + 1] +\
+                                           element[idx - 1]);
+
+                        element[idx] = new; /* Update the grid-point value. */
+                        diff = diff + fabs(new - old); /* Calculate the difference in values. */
+                        num_elements++;
+                    }
+                }
             }
         }
 		
         /* End of an iteration. Check for convergence. */
         diff = diff/num_elements;
         //printf ("Iteration %d. DIFF: %f.\n", num_iter, diff);
-        printf ("Iteration %d. DIFF: %f. NumEl: %d\n", num_iter, diff, num_elements);
+        printf ("Iteration %d. DIFF: %f. NumEl: %zu\n", num_iter, diff, num_elements);
         num_iter++;
 			  
         if (diff < eps) 
@@ -46,4 +75,3 @@ compute_gold (grid_t *grid)
 	
     return num_iter;
 }
-
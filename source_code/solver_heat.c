@@ -0,0 +1,205 @@
+/* Transient solver: explicit time stepping of the heat equation u_t = u_xx + u_yy on the plate.
+ *
+ * One step is the forward Euler update
+ *
+ *     u' = u + r * (N + S + E + W - 4 u),    r = dt / h^2,  h = 1 / (dim - 1)
+ *
+ * which is stable for r <= 1/4. With r = HEAT_R = 1/5 the update is the average of the point and
+ * its four neighbors, a 5-point stencil from stencil.h, so it runs through the same specialized
+ * kernel as the stencil solver. Each thread owns a contiguous block of rows and the threads meet at
+ * a barrier after every step.
+ *
+ * Every frame_interval steps, and after the last step, the grid is saved as a frame through a
+ * FRAME_WRITER (frames.h). As with checkpoints, the threads copy their rows of the frame while they
+ * compute the next step, and the frame is handed to the writer thread at the end of it.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "stencil.h"
+#include "frames.h"
+
+#define CACHE_LINE 64
+#define HEAT_R 0.2f /* dt / h^2, at most 1/4 for stability */
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_heat_thread_t {
+    int thread_idx;
+    double change; /* Sum of |u' - u| over the thread's rows in the last step */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_HEAT_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_HEAT_THREAD) == CACHE_LINE, "ARGS_FOR_HEAT_THREAD must fill one cache line");
+
+/* Forward Euler step with r = 1/5: the point and its four neighbors weigh 1/5 each */
+static const STENCIL stencil_heat = {
+    "heat", 5,
+    {-1, 1, 0, 0, 0},
+    {0, 0, 1, -1, 0},
+    {1.0f, 1.0f, 1.0f, 1.0f, 1.0f},
+    HEAT_R, 0
+};
+
+/* Function prototypes */
+void solve_transient (grid_t *, int, int, const char *, int, int);
+static void *heat_thread (void *);
+static void end_of_step (void *);
+
+extern grid_t *copy_grid (grid_t *);
+extern void print_stats (grid_t *);
+
+/* Shared variables */
+static grid_t *heat_grid;
+static grid_t *heat_temp;
+static ARGS_FOR_HEAT_THREAD *heat_args;
+static BARRIER heat_barrier;
+static int heat_num_threads;
+static int heat_steps; /* Steps to take */
+static int heat_step; /* Steps taken */
+static int heat_done;
+static FRAME_WRITER writer;
+static int frame_interval;
+static float *frame; /* Frame being filled by the threads during this step, if any */
+static int frame_step;
+
+/* Advance grid by num_steps steps, saving every interval-th state to frames_path if it is not
+ * NULL, and print the statistics of the final state. */
+void
+solve_transient (grid_t *grid, int num_threads, int num_steps, const char *frames_path, int interval, int compress)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    double h = 1.0/(grid->dim - 1);
+    struct timeval start, stop;
+    double change = 0.0;
+    int i;
+
+    heat_grid = grid;
+    heat_temp = copy_grid (grid); /* Second buffer, swapped with the grid each step */
+    heat_num_threads = num_threads;
+    heat_steps = num_steps;
+    heat_step = 0;
+    heat_done = (num_steps == 0);
+    frame_interval = (interval > 0) ? interval : 1;
+    frame = NULL;
+    if (frames_path != NULL) {
+        frame_writer_open (&writer, frames_path, grid->dim, HEAT_R * h * h, compress);
+        frame = frame_writer_begin (&writer); /* The initial state is frame 0 */
+        frame_step = 0;
+    }
+    barrier_init (&heat_barrier, num_threads);
+
+    if (posix_memalign ((void **) &heat_args, CACHE_LINE, sizeof (ARGS_FOR_HEAT_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("\nUsing pthreads to advance the grid %d steps of dt = %g\n", num_steps, HEAT_R * h * h);
+    gettimeofday (&start, NULL);
+    for (i = 0; i < num_threads; i++) {
+        heat_args[i].thread_idx = i;
+        heat_args[i].change = 0.0;
+        if ((pthread_create (&thread_id[i], NULL, heat_thread, (void *) &heat_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_join (thread_id[i], NULL);
+        change += heat_args[i].change;
+    }
+
+    if (frames_path != NULL) {
+        if (frame != NULL) {
+            /* The last state, or the initial one when there are no steps; copied here, as no step follows. */
+            for (i = 0; i < grid->dim; i++)
+                memcpy (&frame[(size_t) i * grid->dim], &grid->element[i * grid->stride], sizeof (float) * grid->dim);
+            frame_writer_commit (&writer, frame_step);
+        }
+        frame_writer_close (&writer);
+    }
+    gettimeofday (&stop, NULL);
+
+    printf ("Simulated time %g after %d steps, change in the last step: %f\n", heat_step * HEAT_R * h * h, heat_step, change);
+    printf ("Execution time = %fs\n", (float) (stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000));
+    if (frames_path != NULL)
+        printf ("Frames: %d written to %s, %zu bytes, writer waited for %d times\n", writer.frames, frames_path, writer.bytes, writer.stalls);
+    printf ("Printing statistics for the interior grid points\n");
+    print_stats (grid);
+
+    barrier_destroy (&heat_barrier);
+    free ((void *) heat_temp->element);
+    free ((void *) heat_temp);
+    free ((void *) heat_args);
+    free ((void *) thread_id);
+}
+
+/* The function executed by the threads. Each thread updates a contiguous block of rows, after
+ * copying its share of the rows of the current state into the frame, if one is being taken. */
+static void *
+heat_thread (void *thread_parameter)
+{
+    ARGS_FOR_HEAT_THREAD *parameter = (ARGS_FOR_HEAT_THREAD *) thread_parameter;
+    int dim = heat_grid->dim;
+    size_t stride = heat_grid->stride;
+    int num_rows = dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/heat_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/heat_num_threads;
+    int i;
+
+    while (!heat_done) {
+        const float *src = heat_grid->element; /* Buffers may only be swapped inside the barrier */
+        float *dst = heat_temp->element;
+        double change = 0.0;
+
+        if (frame != NULL) {
+            /* All the rows, boundary included, split evenly among the threads */
+            int first = (parameter->thread_idx * dim)/heat_num_threads;
+            int last = ((parameter->thread_idx + 1) * dim)/heat_num_threads;
+            for (i = first; i < last; i++)
+                memcpy (&frame[(size_t) i * dim], &src[i * stride], sizeof (float) * dim);
+        }
+
+        for (i = start; i < end; i++)
+            change += stencil_relax_row (&stencil_heat, &src[i * stride], &dst[i * stride], stride, NULL, NULL, 1, dim - 1);
+        parameter->change = change;
+
+        barrier_sync (&heat_barrier, end_of_step, NULL); /* Wait here for all threads at the end of each step */
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Queues the frame copied during this step,
+ * swaps the buffers, and starts the next frame when it is due. */
+static void
+end_of_step (void *arg)
+{
+    float *temp;
+
+    if (frame != NULL) {
+        frame_writer_commit (&writer, frame_step);
+        frame = NULL;
+    }
+
+    heat_step++;
+    temp = heat_grid->element;
+    heat_grid->element = heat_temp->element;
+    heat_temp->element = temp;
+    if (heat_step == heat_steps)
+        heat_done = 1;
+
+    if (writer.file != NULL && (heat_step % frame_interval == 0 || heat_done)) {
+        frame = frame_writer_begin (&writer); /* Waits only if the writer is two frames behind */
+        frame_step = heat_step;
+    }
+}
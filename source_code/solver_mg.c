@@ -0,0 +1,343 @@
+/* Geometric multigrid solver.
+ *
+ * Every iteration is one V-cycle over a hierarchy of grids, each about half the dimension of the
+ * one above it. On every level the error equation L e = f, with L e = 4 e - (N + S + E + W) and f
+ * scaled by h^2, is smoothed with red-black Gauss-Seidel sweeps; the residual is restricted to the
+ * next coarser level with full weighting and the coarse correction is prolongated back with bilinear
+ * interpolation. Grid points are mapped by their position on the unit plate, so dimensions whose
+ * levels do not nest (even dim) are handled as well. The finest level is the grid itself, with the
+ * boundary conditions set by create_grid; coarser levels hold corrections and have zero boundaries.
+ *
+ * All threads run the V-cycle together. Each thread owns a contiguous block of rows on every level,
+ * with a barrier after every step. Convergence is tested after every V-cycle on the same quantity as
+ * the jacobi solver, the mean of |0.25 * (N + S + E + W) - u| over the interior points, so a V-cycle
+ * counts as one iteration.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+#define MIN_DIM 5 /* Dimension of the coarsest level, at most */
+#define PRE_SWEEPS 2 /* Smoothing sweeps before restriction */
+#define POST_SWEEPS 2 /* Smoothing sweeps after prolongation */
+#define COARSE_SWEEPS 20 /* Sweeps that solve the coarsest level */
+
+/* One level of the grid hierarchy */
+typedef struct level_s {
+    int dim;
+    size_t stride; /* Floats from one row to the next; the finest level has the layout of the grid */
+    float *u; /* Solution on the finest level, correction on the others */
+    float *f; /* Right-hand side, scaled by h^2 */
+    float *r; /* Residual */
+} LEVEL;
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_mg_thread_t {
+    int thread_idx;
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_MG_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_MG_THREAD) == CACHE_LINE, "ARGS_FOR_MG_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_multigrid (grid_t *, int);
+static void *mg_thread (void *);
+static void end_of_cycle (void *);
+static void v_cycle (int, int);
+static void smooth (int, LEVEL *);
+static void relax_color (LEVEL *, int, int, int);
+static void compute_residual (LEVEL *, int, int);
+static void restrict_residual (LEVEL *, LEVEL *, int, int);
+static void prolongate (LEVEL *, LEVEL *, int, int);
+static double jacobi_difference (LEVEL *, int, int);
+static void row_range (int, int, int *, int *);
+
+extern float eps;
+
+/* Shared variables */
+static LEVEL *levels;
+static int num_levels;
+static ARGS_FOR_MG_THREAD *mg_args;
+static BARRIER mg_barrier;
+static int mg_num_threads;
+static int mg_iter;
+static int mg_done;
+
+int
+compute_using_pthreads_multigrid (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int dim, i;
+
+    /* Build the hierarchy. */
+    num_levels = 1;
+    for (dim = grid->dim; dim > MIN_DIM; dim = (dim + 1)/2)
+        num_levels++;
+    levels = (LEVEL *) malloc (sizeof (LEVEL) * num_levels);
+    for (i = 0, dim = grid->dim; i < num_levels; i++, dim = (dim + 1)/2) {
+        levels[i].dim = dim;
+        levels[i].stride = (i == 0) ? grid->stride : (size_t) dim;
+        levels[i].u = (i == 0) ? grid->element : (float *) calloc (levels[i].stride * dim, sizeof (float));
+        levels[i].f = (float *) calloc (levels[i].stride * dim, sizeof (float));
+        levels[i].r = (float *) calloc (levels[i].stride * dim, sizeof (float));
+        if (levels[i].u == NULL || levels[i].f == NULL || levels[i].r == NULL) {
+            perror ("calloc");
+            exit (EXIT_FAILURE);
+        }
+    }
+    printf ("Multigrid hierarchy: %d levels, coarsest %d x %d\n", num_levels, levels[num_levels - 1].dim, levels[num_levels - 1].dim);
+
+    mg_num_threads = num_threads;
+    mg_iter = 0;
+    mg_done = 0;
+    barrier_init (&mg_barrier, num_threads);
+
+    if (posix_memalign ((void **) &mg_args, CACHE_LINE, sizeof (ARGS_FOR_MG_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        mg_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, mg_thread, (void *) &mg_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    for (i = 0; i < num_levels; i++) {
+        if (i > 0)
+            free ((void *) levels[i].u);
+        free ((void *) levels[i].f);
+        free ((void *) levels[i].r);
+    }
+    free ((void *) levels);
+    barrier_destroy (&mg_barrier);
+    free ((void *) mg_args);
+    free ((void *) thread_id);
+
+    return mg_iter;
+}
+
+/* The function executed by the threads. */
+static void *
+mg_thread (void *thread_parameter)
+{
+    ARGS_FOR_MG_THREAD *parameter = (ARGS_FOR_MG_THREAD *) thread_parameter;
+    int start, end;
+
+    row_range (levels[0].dim, parameter->thread_idx, &start, &end);
+    while (!mg_done) {
+        v_cycle (parameter->thread_idx, 0);
+
+        parameter->diff = jacobi_difference (&levels[0], start, end);
+        barrier_sync (&mg_barrier, end_of_cycle, NULL); /* Wait here for all threads at the end of each V-cycle */
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence. */
+static void
+end_of_cycle (void *arg)
+{
+    size_t num_elements = (size_t) (levels[0].dim - 2) * (levels[0].dim - 2);
+    double diff = 0.0;
+    int i;
+
+    for (i = 0; i < mg_num_threads; i++)
+        diff += mg_args[i].diff;
+    diff = diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", mg_iter, diff);
+    mg_iter++;
+    if (diff < eps)
+        mg_done = 1;
+}
+
+/* One V-cycle starting at level l, executed by all threads. */
+static void
+v_cycle (int thread_idx, int l)
+{
+    LEVEL *fine = &levels[l];
+    int start, end, s;
+
+    if (l == num_levels - 1) {
+        for (s = 0; s < COARSE_SWEEPS; s++)
+            smooth (thread_idx, fine);
+        return;
+    }
+
+    LEVEL *coarse = &levels[l + 1];
+    for (s = 0; s < PRE_SWEEPS; s++)
+        smooth (thread_idx, fine);
+
+    row_range (fine->dim, thread_idx, &start, &end);
+    compute_residual (fine, start, end);
+    barrier_sync (&mg_barrier, NULL, NULL);
+
+    row_range (coarse->dim, thread_idx, &start, &end);
+    restrict_residual (fine, coarse, start, end);
+    barrier_sync (&mg_barrier, NULL, NULL);
+
+    v_cycle (thread_idx, l + 1);
+
+    row_range (fine->dim, thread_idx, &start, &end);
+    prolongate (coarse, fine, start, end);
+    barrier_sync (&mg_barrier, NULL, NULL);
+
+    for (s = 0; s < POST_SWEEPS; s++)
+        smooth (thread_idx, fine);
+}
+
+/* One red-black Gauss-Seidel sweep of a level. */
+static void
+smooth (int thread_idx, LEVEL *level)
+{
+    int start, end;
+
+    row_range (level->dim, thread_idx, &start, &end);
+    relax_color (level, start, end, 0);
+    barrier_sync (&mg_barrier, NULL, NULL);
+    relax_color (level, start, end, 1);
+    barrier_sync (&mg_barrier, NULL, NULL);
+}
+
+/* Update the points of the given color, (i + j) % 2 == color, in rows [start, end). */
+static void
+relax_color (LEVEL *level, int start, int end, int color)
+{
+    int dim = level->dim;
+    size_t stride = level->stride;
+    float *u = level->u;
+    float *f = level->f;
+    int i, j;
+
+    for (i = start; i < end; i++)
+        for (j = 1 + ((i + 1 + color) & 1); j < (dim - 1); j += 2)
+            u[i * stride + j] = 0.25 * (u[(i - 1) * stride + j] + u[(i + 1) * stride + j] +\
+                                     u[i * stride + (j + 1)] + u[i * stride + (j - 1)] + f[i * stride + j]);
+}
+
+/* r = f - L u in rows [start, end). */
+static void
+compute_residual (LEVEL *level, int start, int end)
+{
+    int dim = level->dim;
+    size_t stride = level->stride;
+    float *u = level->u;
+    int i, j;
+
+    for (i = start; i < end; i++)
+        for (j = 1; j < (dim - 1); j++)
+            level->r[i * stride + j] = level->f[i * stride + j] - (4.0 * u[i * stride + j] -\
+                                    (u[(i - 1) * stride + j] + u[(i + 1) * stride + j] +\
+                                     u[i * stride + (j + 1)] + u[i * stride + (j - 1)]));
+}
+
+/* Full-weighted residual of the fine level at interior point (i, j). */
+static inline float
+full_weight (const float *r, int dim, size_t stride, int i, int j)
+{
+    if (i == 0 || j == 0 || i == dim - 1 || j == dim - 1)
+        return 0.0;
+    return (4.0 * r[i * stride + j] +\
+            2.0 * (r[(i - 1) * stride + j] + r[(i + 1) * stride + j] + r[i * stride + (j - 1)] + r[i * stride + (j + 1)]) +\
+            r[(i - 1) * stride + (j - 1)] + r[(i - 1) * stride + (j + 1)] +\
+            r[(i + 1) * stride + (j - 1)] + r[(i + 1) * stride + (j + 1)])/16.0;
+}
+
+/* Restrict the fine residual into the right-hand side of the coarse level for coarse rows [start, end),
+ * and clear the coarse correction. The full-weighted residual is sampled at the position of every coarse
+ * point, which reduces to ordinary full weighting when the levels nest. */
+static void
+restrict_residual (LEVEL *fine, LEVEL *coarse, int start, int end)
+{
+    int fd = fine->dim;
+    int cd = coarse->dim;
+    double ratio = (double) (fd - 1)/(cd - 1);
+    float scale = ratio * ratio; /* f carries a factor h^2 */
+    int i, j;
+
+    for (i = start; i < end; i++) {
+        double y = i * ratio;
+        int i0 = (int) y;
+        float wy = y - i0;
+        for (j = 1; j < (cd - 1); j++) {
+            double x = j * ratio;
+            int j0 = (int) x;
+            float wx = x - j0;
+            float val = (1.0 - wy) * ((1.0 - wx) * full_weight (fine->r, fd, fine->stride, i0, j0) + wx * full_weight (fine->r, fd, fine->stride, i0, j0 + 1)) +\
+                        wy * ((1.0 - wx) * full_weight (fine->r, fd, fine->stride, i0 + 1, j0) + wx * full_weight (fine->r, fd, fine->stride, i0 + 1, j0 + 1));
+            coarse->f[i * coarse->stride + j] = scale * val;
+            coarse->u[i * coarse->stride + j] = 0.0;
+        }
+    }
+}
+
+/* Add the bilinear interpolation of the coarse correction to the fine rows [start, end). */
+static void
+prolongate (LEVEL *coarse, LEVEL *fine, int start, int end)
+{
+    int fd = fine->dim;
+    int cd = coarse->dim;
+    size_t cs = coarse->stride;
+    double ratio = (double) (cd - 1)/(fd - 1);
+    const float *e = coarse->u;
+    int i, j;
+
+    for (i = start; i < end; i++) {
+        double y = i * ratio;
+        int i0 = (int) y;
+        float wy = y - i0;
+        for (j = 1; j < (fd - 1); j++) {
+            double x = j * ratio;
+            int j0 = (int) x;
+            float wx = x - j0;
+            fine->u[i * fine->stride + j] += (1.0 - wy) * ((1.0 - wx) * e[i0 * cs + j0] + wx * e[i0 * cs + j0 + 1]) +\
+                                            wy * ((1.0 - wx) * e[(i0 + 1) * cs + j0] + wx * e[(i0 + 1) * cs + j0 + 1]);
+        }
+    }
+}
+
+/* Sum of |0.25 * (N + S + E + W) - u| over rows [start, end), the change a jacobi sweep would make. */
+static double
+jacobi_difference (LEVEL *level, int start, int end)
+{
+    int dim = level->dim;
+    size_t stride = level->stride;
+    float *u = level->u;
+    double diff = 0.0;
+    float new;
+    int i, j;
+
+    for (i = start; i < end; i++) {
+        for (j = 1; j < (dim - 1); j++) {
+            new = 0.25 * (u[(i - 1) * stride + j] + u[(i + 1) * stride + j] + u[i * stride + (j + 1)] + u[i * stride + (j - 1)]);
+            diff += fabs (new - u[i * stride + j]);
+        }
+    }
+
+    return diff;
+}
+
+/* Interior rows [start, end) of a grid of the given dimension owned by a thread. */
+static void
+row_range (int dim, int thread_idx, int *start, int *end)
+{
+    int num_rows = dim - 2;
+
+    *start = 1 + (thread_idx * num_rows)/mg_num_threads;
+    *end = 1 + ((thread_idx + 1) * num_rows)/mg_num_threads;
+}
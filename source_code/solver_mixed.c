@@ -0,0 +1,360 @@
+/* Mixed-precision jacobi solver.
+ *
+ * A jacobi sweep does almost no arithmetic per byte it moves, so for large grids its speed is set by
+ * memory bandwidth. This solver keeps the two grid buffers in a 16-bit format for the early
+ * iterations, which halves the traffic, and switches to the float grid for the last ones:
+ *
+ *     fp16      IEEE half precision, converted with the F16C instructions, 8 points at a time.
+ *               Used when the compiler targets F16C (-march=native on any recent x86) and every
+ *               point of the grid is within the fp16 range, at most HALF_MAX. Jacobi sweeps never
+ *               leave the range of the initial grid, so the check is made once, before solving.
+ *     bfloat16  the upper half of a float, converted with integer shifts and round-to-nearest-even.
+ *               It has the range of float. Used otherwise.
+ *
+ * Values are converted to float when loaded, the update is evaluated in float in the same order as
+ * the other solvers, and |new - old| is accumulated in double; only the stored result is rounded.
+ * With 11 (fp16) or 8 (bfloat16) significant bits, a change smaller than half a unit in the last
+ * place of a point is lost, so the residual of the reduced-precision phase levels off at a floor
+ * proportional to the unit roundoff times the mean value of the grid. The solver therefore switches
+ * to full precision as soon as the residual drops below SWITCH_FACTOR times eps or that floor, while
+ * it is still falling at the rate of a float sweep: every thread expands its rows into the float
+ * grid and the remaining iterations are ordinary float jacobi sweeps, which converge to the same
+ * criterion as the other solvers. Should the residual of the reduced-precision phase ever not be
+ * finite, the solver discards that phase and starts over from the float grid; a residual that is
+ * not finite in full precision stops the solver.
+ *
+ * Each thread owns a contiguous block of rows.
+ *
+ * Compile with solver.c and -march=native (or -mf16c); see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <math.h>
+#if defined (__F16C__)
+#include <immintrin.h>
+#endif
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+#define SWITCH_FACTOR 4.0 /* Switch to full precision SWITCH_FACTOR times above eps or the rounding floor */
+
+#define HALF_MAX 65504.0 /* Largest finite fp16 value */
+#define FP16_UNIT_ROUNDOFF (1.0/2048) /* 2^-11 */
+#define BFLOAT16_UNIT_ROUNDOFF (1.0/256) /* 2^-8 */
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_mixed_thread_t {
+    int thread_idx;
+    double diff;
+    double sum; /* Sum of the new values, before the switch */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_MIXED_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_MIXED_THREAD) == CACHE_LINE, "ARGS_FOR_MIXED_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_jacobi_mixed (grid_t *, int);
+static void *mixed_thread (void *);
+static void end_of_mixed_iteration (void *);
+static double relax_row_half (const uint16_t *, uint16_t *, size_t, int, double *);
+static double relax_row_float (const float *, float *, size_t, int);
+static inline uint16_t float_to_half (float);
+static inline float half_to_float (uint16_t);
+static inline uint16_t float_to_bfloat16 (float);
+static inline float bfloat16_to_float (uint16_t);
+
+extern float eps;
+extern grid_t *copy_grid (grid_t *);
+
+/* Shared variables */
+static grid_t *mixed_grid; /* Float grid, used after the switch */
+static grid_t *mixed_temp;
+static uint16_t *half_in; /* Reduced-precision buffers, used before the switch */
+static uint16_t *half_out;
+static ARGS_FOR_MIXED_THREAD *mixed_args;
+static BARRIER mixed_barrier;
+static int mixed_num_threads;
+static int mixed_iter;
+static int mixed_done;
+static int full_precision; /* Set once the solver has switched to the float grid */
+static int switch_pending; /* Set for the iteration in which the threads expand their rows */
+static int use_fp16; /* 16-bit storage is fp16 rather than bfloat16 */
+static double unit_roundoff; /* Of the 16-bit storage */
+
+int
+compute_using_pthreads_jacobi_mixed (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    size_t num_points = grid->plane; /* The 16-bit copies have the layout of the grid */
+    size_t k;
+    int i;
+
+    mixed_grid = grid;
+    mixed_temp = copy_grid (grid); /* Second buffer, swapped with the grid each iteration */
+    half_in = (uint16_t *) malloc (sizeof (uint16_t) * num_points);
+    half_out = (uint16_t *) malloc (sizeof (uint16_t) * num_points);
+    if (half_in == NULL || half_out == NULL) {
+        perror ("malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    /* fp16 overflows to inf above HALF_MAX; bfloat16 has the range of float. */
+    use_fp16 = 0;
+#if defined (__F16C__)
+    use_fp16 = 1;
+    for (k = 0; k < num_points; k++)
+        if (fabs (grid->element[k]) > HALF_MAX)
+            use_fp16 = 0;
+#endif
+    unit_roundoff = use_fp16 ? FP16_UNIT_ROUNDOFF : BFLOAT16_UNIT_ROUNDOFF;
+    for (k = 0; k < num_points; k++)
+        half_in[k] = half_out[k] = float_to_half (grid->element[k]);
+
+    mixed_num_threads = num_threads;
+    mixed_iter = 0;
+    mixed_done = 0;
+    full_precision = 0;
+    switch_pending = 0;
+    barrier_init (&mixed_barrier, num_threads);
+
+    if (posix_memalign ((void **) &mixed_args, CACHE_LINE, sizeof (ARGS_FOR_MIXED_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Storage: %s\n", use_fp16 ? "fp16" : "bfloat16");
+    for (i = 0; i < num_threads; i++) {
+        mixed_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, mixed_thread, (void *) &mixed_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    barrier_destroy (&mixed_barrier);
+    free ((void *) mixed_temp->element);
+    free ((void *) mixed_temp);
+    free ((void *) half_in);
+    free ((void *) half_out);
+    free ((void *) mixed_args);
+    free ((void *) thread_id);
+
+    return mixed_iter;
+}
+
+/* The function executed by the threads. Each thread updates a contiguous block of rows. */
+static void *
+mixed_thread (void *thread_parameter)
+{
+    ARGS_FOR_MIXED_THREAD *parameter = (ARGS_FOR_MIXED_THREAD *) thread_parameter;
+    int dim = mixed_grid->dim;
+    size_t stride = mixed_grid->stride;
+    int num_rows = dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/mixed_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/mixed_num_threads;
+    int i, j;
+
+    while (!mixed_done) {
+        double diff = 0.0, sum = 0.0;
+
+        if (switch_pending) {
+            /* Expand the rows of the latest iterate into the float grid before anyone reads them. */
+            for (i = start; i < end; i++)
+                for (j = 1; j < (dim - 1); j++)
+                    mixed_grid->element[i * stride + j] = half_to_float (half_in[i * stride + j]);
+            barrier_sync (&mixed_barrier, NULL, NULL);
+        }
+
+        if (full_precision) {
+            const float *src = mixed_grid->element; /* Buffers may only be swapped inside the barrier */
+            float *dst = mixed_temp->element;
+            for (i = start; i < end; i++)
+                diff += relax_row_float (&src[i * stride + 1], &dst[i * stride + 1], stride, num_rows);
+        }
+        else {
+            for (i = start; i < end; i++)
+                diff += relax_row_half (&half_in[i * stride + 1], &half_out[i * stride + 1], stride, num_rows, &sum);
+        }
+
+        parameter->diff = diff;
+        parameter->sum = sum;
+        barrier_sync (&mixed_barrier, end_of_mixed_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence, decides when to switch
+ * to full precision, and swaps the buffers of the current phase. */
+static void
+end_of_mixed_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (mixed_grid->dim - 2) * (mixed_grid->dim - 2);
+    double diff = 0.0, mean = 0.0;
+    void *temp;
+    int i;
+
+    for (i = 0; i < mixed_num_threads; i++) {
+        diff += mixed_args[i].diff;
+        mean += mixed_args[i].sum;
+    }
+    diff = diff/num_elements;
+    mean = mean/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", mixed_iter, diff);
+    mixed_iter++;
+
+    if (full_precision) {
+        switch_pending = 0;
+        if (!isfinite (diff)) {
+            fprintf (stderr, "Iteration %d. The residual is not finite, giving up.\n", mixed_iter);
+            mixed_done = 1;
+        }
+        if (diff < eps)
+            mixed_done = 1;
+        temp = mixed_grid->element;
+        mixed_grid->element = mixed_temp->element;
+        mixed_temp->element = (float *) temp;
+        return;
+    }
+
+    if (!isfinite (diff)) {
+        /* The 16-bit iterates are lost; the float grid still holds the initial conditions. */
+        printf ("Iteration %d. The residual is not finite, restarting in full precision.\n", mixed_iter);
+        full_precision = 1;
+        return;
+    }
+
+    temp = half_in;
+    half_in = half_out;
+    half_out = (uint16_t *) temp;
+    if (diff < SWITCH_FACTOR * eps || diff < SWITCH_FACTOR * unit_roundoff * mean) {
+        printf ("Iteration %d. Switching to full precision.\n", mixed_iter);
+        full_precision = 1;
+        switch_pending = 1;
+    }
+}
+
+/* Update n consecutive points of reduced-precision storage and return the sum of |new - old|.
+ * The new values are added to *sum. */
+static double
+relax_row_half (const uint16_t *src, uint16_t *dst, size_t stride, int n, double *sum)
+{
+    const uint16_t *above = src - stride, *below = src + stride;
+    double diff = 0.0, total = 0.0;
+    int j = 0;
+
+#if defined (__F16C__)
+    if (use_fp16) {
+        const __m256 quarter = _mm256_set1_ps (0.25f);
+        const __m256 sign = _mm256_set1_ps (-0.0f);
+        __m256d acc_lo = _mm256_setzero_pd ();
+        __m256d acc_hi = _mm256_setzero_pd ();
+        __m256d tot_lo = _mm256_setzero_pd ();
+        __m256d tot_hi = _mm256_setzero_pd ();
+
+        for (; j + 8 <= n; j += 8) {
+            __m256 north = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) &above[j]));
+            __m256 south = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) &below[j]));
+            __m256 east = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) &src[j + 1]));
+            __m256 west = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) &src[j - 1]));
+            __m256 old = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) &src[j]));
+            __m256 new = _mm256_mul_ps (quarter, _mm256_add_ps (_mm256_add_ps (_mm256_add_ps (north, south), east), west));
+            _mm_storeu_si128 ((__m128i *) &dst[j], _mm256_cvtps_ph (new, _MM_FROUND_TO_NEAREST_INT));
+
+            __m256 d = _mm256_andnot_ps (sign, _mm256_sub_ps (new, old));
+            acc_lo = _mm256_add_pd (acc_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (d)));
+            acc_hi = _mm256_add_pd (acc_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (d, 1)));
+            tot_lo = _mm256_add_pd (tot_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (new)));
+            tot_hi = _mm256_add_pd (tot_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (new, 1)));
+        }
+        __m256d acc = _mm256_add_pd (acc_lo, acc_hi);
+        __m128d s = _mm_add_pd (_mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1));
+        diff = _mm_cvtsd_f64 (_mm_add_sd (s, _mm_unpackhi_pd (s, s)));
+        acc = _mm256_add_pd (tot_lo, tot_hi);
+        s = _mm_add_pd (_mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1));
+        total = _mm_cvtsd_f64 (_mm_add_sd (s, _mm_unpackhi_pd (s, s)));
+    }
+#endif
+
+    /* Scalar tail, or the whole row in bfloat16. */
+    for (; j < n; j++) {
+        float new = 0.25 * (half_to_float (above[j]) + half_to_float (below[j]) +\
+                            half_to_float (src[j + 1]) + half_to_float (src[j - 1]));
+        diff += fabs (new - half_to_float (src[j]));
+        total += new;
+        dst[j] = float_to_half (new);
+    }
+
+    *sum += total;
+    return diff;
+}
+
+/* Update n consecutive points of the float grid and return the sum of |new - old|. */
+static double
+relax_row_float (const float *src, float *dst, size_t stride, int n)
+{
+    const float *above = src - stride, *below = src + stride;
+    double diff = 0.0;
+    float new;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        new = 0.25 * (above[j] + below[j] + src[j + 1] + src[j - 1]);
+        diff += fabs (new - src[j]);
+        dst[j] = new;
+    }
+
+    return diff;
+}
+
+/* Conversions to and from the 16-bit storage format chosen for the solve. */
+static inline uint16_t
+float_to_half (float x)
+{
+#if defined (__F16C__)
+    if (use_fp16)
+        return _cvtss_sh (x, _MM_FROUND_TO_NEAREST_INT);
+#endif
+    return float_to_bfloat16 (x);
+}
+
+static inline float
+half_to_float (uint16_t h)
+{
+#if defined (__F16C__)
+    if (use_fp16)
+        return _cvtsh_ss (h);
+#endif
+    return bfloat16_to_float (h);
+}
+
+/* bfloat16: keep the upper 16 bits of the float, rounded to nearest even. The grid never holds
+ * NaNs, so the rounding does not need to guard against them. */
+static inline uint16_t
+float_to_bfloat16 (float x)
+{
+    uint32_t bits;
+
+    memcpy (&bits, &x, sizeof (bits));
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t) (bits >> 16);
+}
+
+static inline float
+bfloat16_to_float (uint16_t h)
+{
+    uint32_t bits = (uint32_t) h << 16;
+    float x;
+
+    memcpy (&x, &bits, sizeof (x));
+    return x;
+}
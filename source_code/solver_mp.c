@@ -0,0 +1,177 @@
+/* Multi-process jacobi solver.
+ *
+ * The grid is divided into strips of rows and each strip is solved by a separate process with its
+ * own memory: the strip plus one halo row above and below, in two time levels. After every sweep a
+ * process posts its first and last rows, the residuals are summed across all processes, and the
+ * halo rows are refreshed from the neighbors. All communication goes through the TRANSPORT
+ * interface in transport.h; this file only uses its operations, so the same code runs on any
+ * backend. The shared-memory backend in transport_shm.c is used here, with the processes forked
+ * from the calling one and pinned to disjoint sets of CPUs. When the global residual drops below
+ * eps, every process gathers its strip into the result grid.
+ *
+ * Every process sees the same global sum, summed in rank order, so they all stop after the same
+ * iteration, which is the iteration at which the other jacobi solvers stop.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <math.h>
+#include "grid.h"
+#include "transport.h"
+
+/* Function prototypes */
+int compute_using_processes (grid_t *, int);
+static int solve_strip (TRANSPORT *, grid_t *);
+static void pin_to_cpus (int, int);
+
+extern float eps;
+
+int
+compute_using_processes (grid_t *grid, int num_procs)
+{
+    TRANSPORT *transport;
+    pid_t *pids;
+    int status, failed = 0;
+    int num_iter = 0;
+    int pipe_fd[2];
+    int rank, i;
+
+    if (num_procs > grid->dim - 2)
+        num_procs = grid->dim - 2; /* Every process needs at least one row */
+    transport = shm_transport_create (num_procs, grid->dim);
+    pids = (pid_t *) malloc (sizeof (pid_t) * num_procs);
+    if (pipe (pipe_fd) < 0) { /* Rank 0 reports the iteration count through it */
+        perror ("pipe");
+        exit (EXIT_FAILURE);
+    }
+    fflush (stdout);
+
+    for (rank = 0; rank < num_procs; rank++) {
+        pids[rank] = fork ();
+        if (pids[rank] < 0) {
+            perror ("fork");
+            exit (EXIT_FAILURE);
+        }
+        if (pids[rank] == 0) {
+            shm_transport_set_rank (transport, rank);
+            pin_to_cpus (rank, num_procs);
+            num_iter = solve_strip (transport, grid);
+            if (rank == 0 && write (pipe_fd[1], &num_iter, sizeof (num_iter)) != sizeof (num_iter))
+                perror ("write");
+            fflush (stdout);
+            _exit (EXIT_SUCCESS);
+        }
+    }
+
+    for (rank = 0; rank < num_procs; rank++) {
+        if (waitpid (pids[rank], &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+            failed = 1;
+    }
+    if (failed || read (pipe_fd[0], &num_iter, sizeof (num_iter)) != sizeof (num_iter)) {
+        fprintf (stderr, "A solver process failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Rows 0 and dim - 1 are the boundary, which no process changes. The result rows are not
+     * padded. */
+    for (i = 1; i < grid->dim - 1; i++)
+        memcpy (&grid->element[i * grid->stride], &shm_transport_result (transport)[(size_t) i * grid->dim],
+                sizeof (float) * grid->dim);
+
+    close (pipe_fd[0]);
+    close (pipe_fd[1]);
+    free ((void *) pids);
+    shm_transport_destroy (transport);
+
+    return num_iter;
+}
+
+/* Solve the strip of the calling rank. The strip is local row 1 to rows, with halo rows 0 and
+ * rows + 1, stored without the padding of the grid rows. Returns the number of iterations. */
+static int
+solve_strip (TRANSPORT *transport, grid_t *grid)
+{
+    int dim = grid->dim;
+    int num_rows = dim - 2;
+    size_t num_elements = (size_t) num_rows * num_rows;
+    int start = 1 + (transport->rank * num_rows)/transport->size;
+    int end = 1 + ((transport->rank + 1) * num_rows)/transport->size;
+    int rows = end - start;
+    size_t strip_size = sizeof (float) * (size_t) (rows + 2) * dim;
+    float *cur = (float *) malloc (strip_size);
+    float *nxt = (float *) malloc (strip_size);
+    float *temp, old, new;
+    int iter = 0;
+    int i, j;
+
+    /* Grid rows start - 1 to end, including the halo rows, which are the boundary at the ends. */
+    for (i = 0; i < rows + 2; i++)
+        memcpy (&cur[i * dim], &grid->element[(start - 1 + i) * grid->stride], sizeof (float) * dim);
+    memcpy (nxt, cur, strip_size);
+
+    for (;;) {
+        double diff = 0.0;
+
+        for (i = 1; i <= rows; i++) {
+            for (j = 1; j < (dim - 1); j++) {
+                old = cur[i * dim + j]; /* Store old value of grid point. */
+                /* Apply the update rule. */
+                new = 0.25 * (cur[(i - 1) * dim + j] +\
+                              cur[(i + 1) * dim + j] +\
+                              cur[i * dim + (j + 1)] +\
+                              cur[i * dim + (j - 1)]);
+
+                nxt[i * dim + j] = new; /* Update the grid-point value. */
+                diff = diff + fabs (new - old); /* Calculate the difference in values. */
+            }
+        }
+
+        transport->ops->post_halos (transport, &nxt[dim], &nxt[rows * dim]);
+        diff = transport->ops->allreduce_sum (transport, diff)/num_elements;
+        if (transport->rank == 0)
+            printf ("Iteration %d. DIFF: %f.\n", iter, diff);
+        iter++;
+
+        temp = cur;
+        cur = nxt;
+        nxt = temp;
+        if (diff < eps)
+            break;
+
+        transport->ops->wait_halos (transport,
+                                    (transport->rank > 0) ? &cur[0] : NULL,
+                                    (transport->rank < transport->size - 1) ? &cur[(rows + 1) * dim] : NULL);
+    }
+
+    transport->ops->gather (transport, &cur[dim], start, rows);
+    free ((void *) cur);
+    free ((void *) nxt);
+
+    return iter;
+}
+
+/* Restrict the calling process to its share of the CPUs, so that its strip stays in the memory of
+ * the node it runs on. Errors are ignored: pinning is only a placement hint. */
+static void
+pin_to_cpus (int rank, int num_procs)
+{
+    long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    long cpu;
+
+    if (num_cpus < num_procs)
+        return;
+    CPU_ZERO (&set);
+    for (cpu = (rank * num_cpus)/num_procs; cpu < ((rank + 1) * num_cpus)/num_procs; cpu++)
+        CPU_SET (cpu, &set);
+    sched_setaffinity (0, sizeof (set), &set);
+}
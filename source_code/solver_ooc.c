@@ -0,0 +1,481 @@
+/* Out-of-core jacobi solver for grids that do not fit in memory.
+ *
+ * The grid lives in a file that holds two copies of it, region 0 and region 1, at the current and
+ * the next time level. A pass streams the current region through memory in bands of rows and
+ * writes the next one. To amortize the disk traffic, each pass advances the grid by time_steps
+ * jacobi iterations (temporal blocking): the band of rows [r0, r1) is loaded together with
+ * time_steps halo rows on either side, and step s is computed on rows [r0 - T + s, r1 + T - s), so
+ * after T steps the owned rows are exact and only they are written back. The halo rows are
+ * recomputed by the neighboring bands, which costs 2T rows of work per band and step.
+ *
+ * Three band buffers rotate between a reader thread, the worker threads and a writer thread, so
+ * that band k + 1 is read and band k - 1 is written while the workers compute band k. Within a
+ * band the workers split the rows and meet at a barrier after every step. At the end of a pass the
+ * writer drains, the residual of the last step is tested against eps, and the two regions swap
+ * roles. As with the -c option of the jacobi method, convergence is only tested every time_steps
+ * iterations.
+ *
+ * The memory used is three buffers of two (band_rows + 2 time_steps) x dim arrays, at most
+ * OOC_MEMORY bytes.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+#define OOC_TIME_STEPS 8 /* Iterations per pass over the file */
+#ifndef OOC_MEMORY
+#define OOC_MEMORY (256L * 1024 * 1024) /* Bytes of band buffers; may be set with -D */
+#endif
+#define NUM_SLOTS 3 /* Band buffers: being read, being computed, being written */
+
+/* Buffer for one band and its halo: rows [w0, w1) of the grid, in two time levels */
+typedef struct band_slot_s {
+    float *a, *b;
+    float *result; /* a or b, whichever holds the last step */
+    sem_t free; /* Posted by the writer when the buffer may be refilled */
+    sem_t loaded; /* Posted by the reader when the band has been read */
+    sem_t computed; /* Posted by the workers when the band is ready to be written */
+} BAND_SLOT;
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_ooc_thread_t {
+    int thread_idx;
+    double diff; /* Sum of |new - old| of the last step of the pass */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_OOC_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_OOC_THREAD) == CACHE_LINE, "ARGS_FOR_OOC_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_out_of_core (grid_t *, int);
+void solve_plate_out_of_core (const char *, int, int, float, float);
+static int ooc_solve (int, int, int, int *);
+static void *ooc_thread (void *);
+static void *reader_thread (void *);
+static void *writer_thread (void *);
+static void begin_band (void *);
+static void end_of_step (void *);
+static void end_of_pass (void *);
+static void band_window (int, int *, int *, int *, int *);
+static void read_rows (int, float *, int, long, int);
+static void write_rows (int, const float *, int, long, int);
+
+extern float eps;
+
+/* Shared variables */
+static int ooc_fd;
+static int ooc_dim;
+static int ooc_src; /* Region holding the current time level */
+static int band_rows;
+static int num_bands;
+static BAND_SLOT slots[NUM_SLOTS];
+static sem_t reader_go, writer_go, pass_written;
+static ARGS_FOR_OOC_THREAD *ooc_args;
+static BARRIER ooc_barrier;
+static int ooc_num_threads;
+static float *band_cur, *band_nxt; /* Time levels of the band being computed */
+static int ooc_band;
+static int ooc_iter;
+static int ooc_done;
+
+/* Solve a grid held in memory through a temporary file; used to check the out-of-core solver
+ * against the others. */
+int
+compute_using_pthreads_out_of_core (grid_t *grid, int num_threads)
+{
+    FILE *file = tmpfile ();
+    int region, num_iter, i;
+
+    if (file == NULL) {
+        perror ("tmpfile");
+        exit (EXIT_FAILURE);
+    }
+    /* The file holds the rows without the padding of the grid rows. */
+    for (i = 0; i < grid->dim; i++)
+        write_rows (fileno (file), &grid->element[i * grid->stride], grid->dim, i, 1);
+    num_iter = ooc_solve (fileno (file), grid->dim, num_threads, &region);
+    for (i = 0; i < grid->dim; i++)
+        read_rows (fileno (file), &grid->element[i * grid->stride], grid->dim, (long) region * grid->dim + i, 1);
+    fclose (file);
+
+    return num_iter;
+}
+
+/* Create a plate with the same initial conditions as create_grid directly in a file, solve it out
+ * of core, and print the statistics of the interior points. */
+void
+solve_plate_out_of_core (const char *path, int dim, int num_threads, float min, float max)
+{
+    FILE *file = fopen (path, "w+");
+    float *row = (float *) calloc (dim, sizeof (float));
+    struct timeval start, stop;
+    double sum = 0.0;
+    float min_val = INFINITY, max_val = 0.0;
+    int region, num_iter, i, j;
+
+    if (file == NULL || row == NULL) {
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    /* Both regions start out as zeros; the file is sparse until it is written. */
+    if (ftruncate (fileno (file), 2 * sizeof (float) * (off_t) dim * dim) < 0) {
+        perror ("ftruncate");
+        exit (EXIT_FAILURE);
+    }
+    printf ("Creating a grid of dimension %d x %d in %s\n", dim, dim, path);
+    srand ((unsigned) time (NULL));
+    for (j = 1; j < (dim - 1); j++)
+        row[j] = min + (max - min) * rand ()/(float) RAND_MAX;
+    write_rows (fileno (file), row, dim, 0, 1);
+
+    printf ("\nUsing pthreads to solve the grid out of core\n");
+    gettimeofday (&start, NULL);
+    num_iter = ooc_solve (fileno (file), dim, num_threads, &region);
+    gettimeofday (&stop, NULL);
+    printf ("Convergence achieved after %d iterations\n", num_iter);
+    printf ("Execution time = %fs\n", (float) (stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000));
+
+    printf ("Printing statistics for the interior grid points\n");
+    for (i = 1; i < (dim - 1); i++) {
+        read_rows (fileno (file), row, dim, (long) region * dim + i, 1);
+        for (j = 1; j < (dim - 1); j++) {
+            sum += row[j];
+            if (row[j] > max_val)
+                max_val = row[j];
+            if (row[j] < min_val)
+                min_val = row[j];
+        }
+    }
+    printf ("AVG: %f\n", sum/((double) (dim - 2) * (dim - 2)));
+    printf ("MIN: %f\n", min_val);
+    printf ("MAX: %f\n", max_val);
+    printf ("\n");
+
+    free ((void *) row);
+    fclose (file);
+}
+
+/* Solve the grid in region 0 of the file. Returns the number of iterations and sets *region to the
+ * region that holds the result. */
+static int
+ooc_solve (int fd, int dim, int num_threads, int *region)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    pthread_t reader, writer;
+    float *row = (float *) malloc (sizeof (float) * dim);
+    size_t band_size;
+    int i;
+
+    ooc_fd = fd;
+    ooc_dim = dim;
+    ooc_src = 0;
+    ooc_num_threads = num_threads;
+    ooc_band = 0;
+    ooc_iter = 0;
+    ooc_done = 0;
+
+    /* Region 1 needs the boundary rows too; the passes only write the interior rows. */
+    read_rows (fd, row, dim, 0, 1);
+    write_rows (fd, row, dim, dim, 1);
+    read_rows (fd, row, dim, dim - 1, 1);
+    write_rows (fd, row, dim, 2 * dim - 1, 1);
+    free ((void *) row);
+
+    band_rows = OOC_MEMORY/(2 * NUM_SLOTS * sizeof (float) * (long) dim) - 2 * OOC_TIME_STEPS;
+    if (band_rows < OOC_TIME_STEPS)
+        band_rows = OOC_TIME_STEPS;
+    if (band_rows > dim - 2)
+        band_rows = dim - 2;
+    num_bands = (dim - 2 + band_rows - 1)/band_rows;
+    band_size = sizeof (float) * (size_t) (band_rows + 2 * OOC_TIME_STEPS) * dim;
+    printf ("Out of core: %d bands of %d rows, %d iterations per pass\n", num_bands, band_rows, OOC_TIME_STEPS);
+
+    for (i = 0; i < NUM_SLOTS; i++) {
+        slots[i].a = (float *) malloc (band_size);
+        slots[i].b = (float *) malloc (band_size);
+        if (slots[i].a == NULL || slots[i].b == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+        sem_init (&slots[i].free, 0, 1);
+        sem_init (&slots[i].loaded, 0, 0);
+        sem_init (&slots[i].computed, 0, 0);
+    }
+    sem_init (&reader_go, 0, 1); /* The first pass may start right away */
+    sem_init (&writer_go, 0, 1);
+    sem_init (&pass_written, 0, 0);
+    barrier_init (&ooc_barrier, num_threads);
+
+    if (posix_memalign ((void **) &ooc_args, CACHE_LINE, sizeof (ARGS_FOR_OOC_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    if (pthread_create (&reader, NULL, reader_thread, NULL) != 0 ||
+        pthread_create (&writer, NULL, writer_thread, NULL) != 0) {
+        perror ("pthread_create");
+        exit (EXIT_FAILURE);
+    }
+    for (i = 0; i < num_threads; i++) {
+        ooc_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, ooc_thread, (void *) &ooc_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+    pthread_join (reader, NULL);
+    pthread_join (writer, NULL);
+
+    for (i = 0; i < NUM_SLOTS; i++) {
+        free ((void *) slots[i].a);
+        free ((void *) slots[i].b);
+        sem_destroy (&slots[i].free);
+        sem_destroy (&slots[i].loaded);
+        sem_destroy (&slots[i].computed);
+    }
+    sem_destroy (&reader_go);
+    sem_destroy (&writer_go);
+    sem_destroy (&pass_written);
+    barrier_destroy (&ooc_barrier);
+    free ((void *) ooc_args);
+    free ((void *) thread_id);
+
+    *region = ooc_src;
+    return ooc_iter;
+}
+
+/* The function executed by the worker threads. For every band of every pass, each thread
+ * computes its share of the rows of each step. */
+static void *
+ooc_thread (void *thread_parameter)
+{
+    ARGS_FOR_OOC_THREAD *parameter = (ARGS_FOR_OOC_THREAD *) thread_parameter;
+    int dim = ooc_dim;
+    int r0, r1, w0, w1, lo, hi, first, last, s, k, i, j;
+    float old, new;
+
+    while (!ooc_done) {
+        parameter->diff = 0.0;
+
+        for (k = 0; k < num_bands; k++) {
+            barrier_sync (&ooc_barrier, begin_band, NULL); /* Wait for the reader */
+            band_window (k, &r0, &r1, &w0, &w1);
+
+            for (s = 1; s <= OOC_TIME_STEPS; s++) {
+                const float *src = band_cur; /* Swapped inside the barrier */
+                float *dst = band_nxt;
+                double diff = 0.0;
+
+                /* Rows that are still exact after s steps, and this thread's share of them. */
+                lo = (r0 - OOC_TIME_STEPS + s > 1) ? r0 - OOC_TIME_STEPS + s : 1;
+                hi = (r1 + OOC_TIME_STEPS - s < dim - 1) ? r1 + OOC_TIME_STEPS - s : dim - 1;
+                first = lo + (parameter->thread_idx * (hi - lo))/ooc_num_threads;
+                last = lo + ((parameter->thread_idx + 1) * (hi - lo))/ooc_num_threads;
+
+                for (i = first - w0; i < last - w0; i++) {
+                    for (j = 1; j < (dim - 1); j++) {
+                        old = src[i * dim + j];
+                        new = 0.25 * (src[(i - 1) * dim + j] +\
+                                      src[(i + 1) * dim + j] +\
+                                      src[i * dim + (j + 1)] +\
+                                      src[i * dim + (j - 1)]);
+                        dst[i * dim + j] = new;
+                        diff = diff + fabs (new - old);
+                    }
+                }
+                if (s == OOC_TIME_STEPS)
+                    parameter->diff += diff; /* The last step covers exactly the owned rows */
+
+                barrier_sync (&ooc_barrier, end_of_step, (void *) &s);
+            }
+        }
+
+        barrier_sync (&ooc_barrier, end_of_pass, NULL);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier: waits for the next band to be read. */
+static void
+begin_band (void *arg)
+{
+    BAND_SLOT *slot = &slots[ooc_band % NUM_SLOTS];
+
+    sem_wait (&slot->loaded);
+    band_cur = slot->a;
+    band_nxt = slot->b;
+}
+
+/* Executed by the last thread to reach the barrier: swaps the time levels of the band, and after the
+ * last step hands the band to the writer. */
+static void
+end_of_step (void *arg)
+{
+    int step = *(int *) arg;
+    float *temp = band_cur;
+
+    band_cur = band_nxt;
+    band_nxt = temp;
+    if (step == OOC_TIME_STEPS) {
+        BAND_SLOT *slot = &slots[ooc_band % NUM_SLOTS];
+        slot->result = band_cur;
+        sem_post (&slot->computed);
+        ooc_band++;
+    }
+}
+
+/* Executed by the last thread to reach the barrier: waits for the writer to finish the pass, checks
+ * for convergence, and starts the next pass. */
+static void
+end_of_pass (void *arg)
+{
+    size_t num_elements = (size_t) (ooc_dim - 2) * (ooc_dim - 2);
+    double diff = 0.0;
+    int i;
+
+    sem_wait (&pass_written);
+    for (i = 0; i < ooc_num_threads; i++)
+        diff += ooc_args[i].diff;
+    diff = diff/num_elements;
+    ooc_iter += OOC_TIME_STEPS;
+    printf ("Iteration %d. DIFF: %f.\n", ooc_iter - 1, diff);
+    if (diff < eps)
+        ooc_done = 1;
+
+    ooc_src = 1 - ooc_src; /* The region just written holds the current time level */
+    ooc_band = 0;
+    sem_post (&reader_go);
+    sem_post (&writer_go);
+}
+
+/* The function executed by the reader thread: loads each band with its halo into a free buffer. */
+static void *
+reader_thread (void *arg)
+{
+    int dim = ooc_dim;
+    int r0, r1, w0, w1, k, i;
+
+    for (;;) {
+        sem_wait (&reader_go);
+        if (ooc_done)
+            break;
+
+        for (k = 0; k < num_bands; k++) {
+            BAND_SLOT *slot = &slots[k % NUM_SLOTS];
+
+            band_window (k, &r0, &r1, &w0, &w1);
+            sem_wait (&slot->free);
+            read_rows (ooc_fd, slot->a, dim, (long) ooc_src * dim + w0, w1 - w0);
+
+            /* The second time level needs the fixed boundary: the edge columns and, at the top and
+             * bottom of the grid, the boundary rows. */
+            for (i = 0; i < w1 - w0; i++) {
+                slot->b[i * dim] = slot->a[i * dim];
+                slot->b[i * dim + dim - 1] = slot->a[i * dim + dim - 1];
+            }
+            if (w0 == 0)
+                memcpy (slot->b, slot->a, sizeof (float) * dim);
+            if (w1 == dim)
+                memcpy (&slot->b[(dim - 1 - w0) * dim], &slot->a[(dim - 1 - w0) * dim], sizeof (float) * dim);
+
+            sem_post (&slot->loaded);
+        }
+    }
+
+    pthread_exit (NULL);
+}
+
+/* The function executed by the writer thread: writes the owned rows of each computed band. */
+static void *
+writer_thread (void *arg)
+{
+    int dim = ooc_dim;
+    int r0, r1, w0, w1, k;
+
+    for (;;) {
+        sem_wait (&writer_go);
+        if (ooc_done)
+            break;
+
+        for (k = 0; k < num_bands; k++) {
+            BAND_SLOT *slot = &slots[k % NUM_SLOTS];
+
+            band_window (k, &r0, &r1, &w0, &w1);
+            sem_wait (&slot->computed);
+            write_rows (ooc_fd, &slot->result[(r0 - w0) * dim], dim, (long) (1 - ooc_src) * dim + r0, r1 - r0);
+            sem_post (&slot->free);
+        }
+        sem_post (&pass_written);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Band k owns rows [r0, r1) and is loaded with its halo, rows [w0, w1). */
+static void
+band_window (int k, int *r0, int *r1, int *w0, int *w1)
+{
+    *r0 = 1 + k * band_rows;
+    *r1 = (*r0 + band_rows < ooc_dim - 1) ? *r0 + band_rows : ooc_dim - 1;
+    *w0 = (*r0 - OOC_TIME_STEPS > 0) ? *r0 - OOC_TIME_STEPS : 0;
+    *w1 = (*r1 + OOC_TIME_STEPS < ooc_dim) ? *r1 + OOC_TIME_STEPS : ooc_dim;
+}
+
+/* Read num_rows rows of dim floats, starting at row first of the file, into buffer. */
+static void
+read_rows (int fd, float *buffer, int dim, long first, int num_rows)
+{
+    size_t size = sizeof (float) * (size_t) num_rows * dim;
+    off_t offset = sizeof (float) * (off_t) first * dim;
+    char *p = (char *) buffer;
+    ssize_t n;
+
+    while (size > 0) {
+        n = pread (fd, p, size, offset);
+        if (n <= 0) {
+            perror ("pread");
+            exit (EXIT_FAILURE);
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+/* Write num_rows rows of dim floats from buffer, starting at row first of the file. */
+static void
+write_rows (int fd, const float *buffer, int dim, long first, int num_rows)
+{
+    size_t size = sizeof (float) * (size_t) num_rows * dim;
+    off_t offset = sizeof (float) * (off_t) first * dim;
+    const char *p = (const char *) buffer;
+    ssize_t n;
+
+    while (size > 0) {
+        n = pwrite (fd, p, size, offset);
+        if (n <= 0) {
+            perror ("pwrite");
+            exit (EXIT_FAILURE);
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+}
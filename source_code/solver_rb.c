@@ -0,0 +1,226 @@
+/* Red-black Gauss-Seidel and successive over-relaxation (SOR) solvers.
+ *
+ * Points with (i + j) even are red, the others black. A red point only depends on black
+ * neighbors and vice versa, so all red points can be updated in place in parallel, then all
+ * black points, with a barrier between the two half-sweeps. Each thread owns a contiguous block
+ * of rows. No temporary grid is needed, and the solver converges in about as many iterations
+ * as the single-threaded Gauss-Seidel sweep in compute_gold, to the same criterion.
+ *
+ * SOR moves every point past its Gauss-Seidel value, new = old + omega * (gs - old). With the
+ * optimal omega the iteration count grows like dim instead of dim^2. The sor method uses the
+ * optimum for the Laplace equation on a square grid, omega = 2 / (1 + sin (pi / (dim - 1))).
+ * The sor-adaptive method starts from omega = 1 and refines it with Carre's estimate from the
+ * observed decay of the residual, which does not assume a particular problem.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+
+#define CACHE_LINE 64
+#define ADAPT_INTERVAL 10 /* Iterations between two estimates of omega */
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_rb_thread_t {
+    int thread_idx;
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_RB_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_RB_THREAD) == CACHE_LINE, "ARGS_FOR_RB_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_red_black (grid_t *, int);
+int compute_using_pthreads_sor (grid_t *, int);
+int compute_using_pthreads_sor_adaptive (grid_t *, int);
+static int red_black_solve (grid_t *, int, float, int);
+static void *rb_thread (void *);
+static void end_of_rb_iteration (void *);
+static void adapt_omega (double);
+static double relax_color (grid_t *, int, int, int, float);
+
+extern float eps;
+
+/* Shared variables */
+static grid_t *rb_grid;
+static ARGS_FOR_RB_THREAD *rb_args;
+static BARRIER rb_barrier;
+static int rb_num_threads;
+static int rb_iter;
+static int rb_done;
+static float rb_omega; /* Relaxation factor, 1 for Gauss-Seidel */
+static int rb_adaptive;
+static double rb_last_diff; /* Residual at the last estimate of omega */
+static float rb_last_omega; /* Relaxation factor before the last estimate */
+
+int
+compute_using_pthreads_red_black (grid_t *grid, int num_threads)
+{
+    return red_black_solve (grid, num_threads, 1.0, 0);
+}
+
+int
+compute_using_pthreads_sor (grid_t *grid, int num_threads)
+{
+    float omega = 2.0/(1.0 + sin (M_PI/(grid->dim - 1)));
+    return red_black_solve (grid, num_threads, omega, 0);
+}
+
+int
+compute_using_pthreads_sor_adaptive (grid_t *grid, int num_threads)
+{
+    return red_black_solve (grid, num_threads, 1.0, 1);
+}
+
+static int
+red_black_solve (grid_t *grid, int num_threads, float omega, int adaptive)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int i;
+
+    rb_grid = grid;
+    rb_omega = omega;
+    rb_adaptive = adaptive;
+    rb_last_diff = 0.0;
+    rb_last_omega = omega;
+    rb_num_threads = num_threads;
+    rb_iter = 0;
+    rb_done = 0;
+    barrier_init (&rb_barrier, num_threads);
+
+    if (posix_memalign ((void **) &rb_args, CACHE_LINE, sizeof (ARGS_FOR_RB_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        rb_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, rb_thread, (void *) &rb_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    if (rb_omega != 1.0)
+        printf ("Relaxation factor omega = %f\n", rb_omega);
+    barrier_destroy (&rb_barrier);
+    free ((void *) rb_args);
+    free ((void *) thread_id);
+
+    return rb_iter;
+}
+
+/* The function executed by the threads. Each thread updates a contiguous block of rows. */
+static void *
+rb_thread (void *thread_parameter)
+{
+    ARGS_FOR_RB_THREAD *parameter = (ARGS_FOR_RB_THREAD *) thread_parameter;
+    int num_rows = rb_grid->dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/rb_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/rb_num_threads;
+
+    while (!rb_done) {
+        float omega = rb_omega; /* Only changed inside the barrier */
+        double diff = relax_color (rb_grid, start, end, 0, omega); /* Red half-sweep */
+        barrier_sync (&rb_barrier, NULL, NULL); /* Black points need the new red values */
+        diff += relax_color (rb_grid, start, end, 1, omega); /* Black half-sweep */
+
+        parameter->diff = diff;
+        barrier_sync (&rb_barrier, end_of_rb_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence. */
+static void
+end_of_rb_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (rb_grid->dim - 2) * (rb_grid->dim - 2);
+    double diff = 0.0;
+    int i;
+
+    for (i = 0; i < rb_num_threads; i++)
+        diff += rb_args[i].diff;
+    diff = diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", rb_iter, diff);
+    rb_iter++;
+    if (diff < eps)
+        rb_done = 1;
+    else if (rb_adaptive && (rb_iter % ADAPT_INTERVAL) == 0)
+        adapt_omega (diff);
+}
+
+/* Carre's method: the residual of SOR with factor omega decays by lambda per iteration, where
+ * (lambda + omega - 1)^2 = lambda * omega^2 * rho^2 and rho is the spectral radius of the jacobi
+ * iteration. Solve for rho^2 and move omega towards the optimum 2 / (1 + sqrt (1 - rho^2)),
+ * staying slightly below it as Carre recommends. Each step may at most halve 2 - omega, since
+ * early estimates are noisy. Past the optimum lambda drops to omega - 1 and carries no more
+ * information, so omega falls back to the previous value and adaptation stops. */
+static void
+adapt_omega (double diff)
+{
+    if (rb_last_diff > 0.0 && diff < rb_last_diff) {
+        double lambda = pow (diff/rb_last_diff, 1.0/ADAPT_INTERVAL);
+        if (lambda <= 1.05 * (rb_omega - 1.0)) {
+            rb_omega = rb_last_omega;
+            rb_adaptive = 0;
+            printf ("Iteration %d. Omega: %f.\n", rb_iter, rb_omega);
+            return;
+        }
+
+        double rho2 = (lambda + rb_omega - 1.0) * (lambda + rb_omega - 1.0)/(lambda * rb_omega * rb_omega);
+        if (rho2 < 1.0) {
+            double omega = 2.0/(1.0 + sqrt (1.0 - rho2));
+            omega = omega - (2.0 - omega)/4.0;
+            if (omega > rb_omega + (2.0 - rb_omega)/2.0)
+                omega = rb_omega + (2.0 - rb_omega)/2.0;
+            if (omega > rb_omega) { /* The estimate approaches the optimum from below */
+                rb_last_omega = rb_omega;
+                rb_omega = omega;
+                printf ("Iteration %d. Omega: %f.\n", rb_iter, rb_omega);
+            }
+        }
+    }
+    rb_last_diff = diff;
+}
+
+/* Update the points of the given color, (i + j) % 2 == color, in rows [start, end), with
+ * relaxation factor omega. Returns the sum of the differences. */
+static double
+relax_color (grid_t *grid, int start, int end, int color, float omega)
+{
+    int dim = grid->dim;
+    size_t stride = grid->stride;
+    float *element = grid->element;
+    double diff = 0.0;
+    float old, new;
+    int i, j;
+
+    for (i = start; i < end; i++) {
+        for (j = 1 + ((i + 1 + color) & 1); j < (dim - 1); j += 2) {
+            old = element[i * stride + j]; /* Store old value of grid point. */
+            /* Apply the update rule. */
+            new = 0.25 * (element[(i - 1) * stride + j] +\
+                          element[(i + 1) * stride + j] +\
+                          element[i * stride + (j + 1)] +\
+                          element[i * stride + (j - 1)]);
+            if (omega != 1.0)
+                new = old + omega * (new - old); /* Over-relax */
+
+            element[i * stride + j] = new; /* Update the grid-point value. */
+            diff = diff + fabs (new - old); /* Calculate the difference in values. */
+        }
+    }
+
+    return diff;
+}
@@ -0,0 +1,267 @@
+/* Jacobi solver with a SIMD row kernel.
+ *
+ * The grid is copied into a private layout whose rows are padded to a multiple of the vector
+ * width, with the first interior column of every row aligned, so the north, south and center
+ * loads and the stores are aligned and only the east and west loads are not. Each thread owns
+ * a contiguous block of rows. The row kernel updates 16 (AVX-512) or 8 (AVX2) points per
+ * instruction and accumulates |new - old| in double-precision vector registers; the tail of
+ * the row is handled with a mask (AVX-512) or a scalar loop (AVX2). Without either instruction
+ * set the kernel falls back to scalar code on the same layout.
+ *
+ * The update is evaluated in the same order as the scalar code, 0.25 * (N + S + E + W), so the
+ * grid values are bitwise identical to the other jacobi solvers.
+ *
+ * Compile with solver.c and -march=native (or -mavx2 / -mavx512f); see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#if defined (__AVX512F__) || defined (__AVX2__)
+#include <immintrin.h>
+#endif
+#include "grid.h"
+#include "barrier.h"
+#include "trace.h"
+
+#if defined (__AVX512F__)
+#define VEC_WIDTH 16
+#elif defined (__AVX2__)
+#define VEC_WIDTH 8
+#else
+#define VEC_WIDTH 4
+#endif
+
+#define CACHE_LINE 64
+
+/* Grid with rows padded to a multiple of VEC_WIDTH, element (i, j) at element[i * stride + j].
+ * Column 1 of every row is aligned to the vector width. */
+typedef struct padded_grid_s {
+    int dim;
+    size_t stride;
+    float *base; /* Start of the allocation */
+    float *element;
+} PADDED_GRID;
+
+/* Structure used to pass arguments to the worker threads. Aligned to a cache line so that the
+ * residuals written by different threads do not share a line. */
+typedef struct args_for_simd_thread_t {
+    int thread_idx;
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_SIMD_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_SIMD_THREAD) == CACHE_LINE, "ARGS_FOR_SIMD_THREAD must fill one cache line");
+
+/* Function prototypes */
+int compute_using_pthreads_jacobi_simd (grid_t *, int);
+static void *simd_thread (void *);
+static void end_of_simd_iteration (void *);
+static double relax_row_simd (const float *, float *, size_t, int);
+static PADDED_GRID *create_padded_grid (grid_t *);
+static void free_padded_grid (PADDED_GRID *);
+
+extern float eps;
+extern int max_iter;
+
+/* Shared variables */
+static PADDED_GRID *simd_in;
+static PADDED_GRID *simd_out;
+static ARGS_FOR_SIMD_THREAD *simd_args;
+static BARRIER simd_barrier;
+static int simd_num_threads;
+static int simd_iter;
+static int simd_done;
+
+int
+compute_using_pthreads_jacobi_simd (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int i;
+
+    simd_in = create_padded_grid (grid);
+    simd_out = create_padded_grid (grid);
+    simd_num_threads = num_threads;
+    simd_iter = 0;
+    simd_done = 0;
+    barrier_init (&simd_barrier, num_threads);
+
+    if (posix_memalign ((void **) &simd_args, CACHE_LINE, sizeof (ARGS_FOR_SIMD_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Vector width: %d floats, row stride: %zu\n", VEC_WIDTH, simd_in->stride);
+    for (i = 0; i < num_threads; i++) {
+        simd_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, simd_thread, (void *) &simd_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    /* Copy the converged values back into the grid data structure. */
+    for (i = 0; i < grid->dim; i++)
+        memcpy (&grid->element[i * grid->stride], &simd_in->element[i * simd_in->stride], sizeof (float) * grid->dim);
+
+    barrier_destroy (&simd_barrier);
+    free ((void *) simd_args);
+    free_padded_grid (simd_in);
+    free_padded_grid (simd_out);
+    free ((void *) thread_id);
+
+    return simd_iter;
+}
+
+/* The function executed by the threads. Each thread updates a contiguous block of rows. */
+static void *
+simd_thread (void *thread_parameter)
+{
+    ARGS_FOR_SIMD_THREAD *parameter = (ARGS_FOR_SIMD_THREAD *) thread_parameter;
+    int dim = simd_in->dim;
+    size_t stride = simd_in->stride;
+    int num_rows = dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/simd_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/simd_num_threads;
+    int i;
+
+    while (!simd_done) {
+        trace_event (parameter->thread_idx, TRACE_SWEEP_BEGIN);
+        const float *src = simd_in->element;
+        float *dst = simd_out->element;
+        double diff = 0.0;
+
+        for (i = start; i < end; i++)
+            diff += relax_row_simd (&src[i * stride + 1], &dst[i * stride + 1], stride, num_rows);
+
+        parameter->diff = diff;
+        trace_event (parameter->thread_idx, TRACE_SWEEP_END);
+        trace_event (parameter->thread_idx, TRACE_BARRIER_ARRIVE);
+        barrier_sync (&simd_barrier, end_of_simd_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+        trace_event (parameter->thread_idx, TRACE_BARRIER_DEPART);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence and swaps the grids. */
+static void
+end_of_simd_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (simd_in->dim - 2) * (simd_in->dim - 2);
+    double diff = 0.0;
+    PADDED_GRID *temp;
+    int i;
+
+    for (i = 0; i < simd_num_threads; i++)
+        diff += simd_args[i].diff;
+    diff = diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", simd_iter, diff);
+    simd_iter++;
+    if (diff < eps || simd_iter == max_iter)
+        simd_done = 1;
+
+    temp = simd_in;
+    simd_in = simd_out;
+    simd_out = temp;
+}
+
+/* Update n consecutive points starting at src, which is aligned to the vector width,
+ * and return the sum of |new - old|. */
+static double
+relax_row_simd (const float *src, float *dst, size_t stride, int n)
+{
+    const float *above = src - stride, *below = src + stride;
+    double diff = 0.0;
+    int j = 0;
+
+#if defined (__AVX512F__)
+    const __m512 quarter = _mm512_set1_ps (0.25f);
+    __m512d acc_lo = _mm512_setzero_pd ();
+    __m512d acc_hi = _mm512_setzero_pd ();
+
+    for (; j < n; j += VEC_WIDTH) {
+        __mmask16 mask = (n - j >= VEC_WIDTH) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (n - j)) - 1);
+        __m512 north = _mm512_maskz_load_ps (mask, &above[j]);
+        __m512 south = _mm512_maskz_load_ps (mask, &below[j]);
+        __m512 east = _mm512_maskz_loadu_ps (mask, &src[j + 1]);
+        __m512 west = _mm512_maskz_loadu_ps (mask, &src[j - 1]);
+        __m512 old = _mm512_maskz_load_ps (mask, &src[j]);
+        __m512 new = _mm512_mul_ps (quarter, _mm512_add_ps (_mm512_add_ps (_mm512_add_ps (north, south), east), west));
+        _mm512_mask_store_ps (&dst[j], mask, new);
+
+        __m512 d = _mm512_abs_ps (_mm512_sub_ps (new, old));
+        acc_lo = _mm512_add_pd (acc_lo, _mm512_cvtps_pd (_mm512_castps512_ps256 (d)));
+        acc_hi = _mm512_add_pd (acc_hi, _mm512_cvtps_pd (_mm256_castpd_ps (_mm512_extractf64x4_pd (_mm512_castps_pd (d), 1))));
+    }
+    diff = _mm512_reduce_add_pd (_mm512_add_pd (acc_lo, acc_hi));
+#elif defined (__AVX2__)
+    const __m256 quarter = _mm256_set1_ps (0.25f);
+    const __m256 sign = _mm256_set1_ps (-0.0f);
+    __m256d acc_lo = _mm256_setzero_pd ();
+    __m256d acc_hi = _mm256_setzero_pd ();
+
+    for (; j + VEC_WIDTH <= n; j += VEC_WIDTH) {
+        __m256 north = _mm256_load_ps (&above[j]);
+        __m256 south = _mm256_load_ps (&below[j]);
+        __m256 east = _mm256_loadu_ps (&src[j + 1]);
+        __m256 west = _mm256_loadu_ps (&src[j - 1]);
+        __m256 old = _mm256_load_ps (&src[j]);
+        __m256 new = _mm256_mul_ps (quarter, _mm256_add_ps (_mm256_add_ps (_mm256_add_ps (north, south), east), west));
+        _mm256_store_ps (&dst[j], new);
+
+        __m256 d = _mm256_andnot_ps (sign, _mm256_sub_ps (new, old));
+        acc_lo = _mm256_add_pd (acc_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (d)));
+        acc_hi = _mm256_add_pd (acc_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (d, 1)));
+    }
+    __m256d acc = _mm256_add_pd (acc_lo, acc_hi);
+    __m128d sum = _mm_add_pd (_mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1));
+    diff = _mm_cvtsd_f64 (_mm_add_sd (sum, _mm_unpackhi_pd (sum, sum)));
+#endif
+
+    /* Scalar tail, or the whole row without SIMD support. */
+    for (; j < n; j++) {
+        float new = 0.25 * (above[j] + below[j] + src[j + 1] + src[j - 1]);
+        diff += fabs (new - src[j]);
+        dst[j] = new;
+    }
+
+    return diff;
+}
+
+/* Copy a grid into the padded layout. */
+static PADDED_GRID *
+create_padded_grid (grid_t *grid)
+{
+    PADDED_GRID *padded = (PADDED_GRID *) malloc (sizeof (PADDED_GRID));
+    int lead = VEC_WIDTH - 1; /* Puts column 1 of row 0 on an aligned address */
+    int i;
+
+    padded->dim = grid->dim;
+    padded->stride = ((grid->dim + VEC_WIDTH - 1)/VEC_WIDTH) * VEC_WIDTH;
+    if (posix_memalign ((void **) &padded->base, VEC_WIDTH * sizeof (float),
+                        sizeof (float) * ((size_t) padded->stride * padded->dim + lead + 1)) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    memset (padded->base, 0, sizeof (float) * ((size_t) padded->stride * padded->dim + lead + 1));
+    padded->element = padded->base + lead;
+
+    for (i = 0; i < grid->dim; i++)
+        memcpy (&padded->element[i * padded->stride], &grid->element[i * grid->stride], sizeof (float) * grid->dim);
+
+    return padded;
+}
+
+static void
+free_padded_grid (PADDED_GRID *padded)
+{
+    free ((void *) padded->base);
+    free ((void *) padded);
+}
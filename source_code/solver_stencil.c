@@ -0,0 +1,312 @@
+/* Jacobi solver for the stencils described in stencil.h.
+ *
+ * The operator is selected with select_stencil (the -S option of solver) from the 5-point and
+ * 9-point Laplacians, anisotropic diffusion, and diffusion with a diffusivity that varies over the
+ * plate. Each thread owns a contiguous block of rows. Every stencil has its own row sweep, which
+ * passes the constant descriptor to the inlined generic kernel, so each sweep is compiled for its
+ * stencil as if it had been written by hand.
+ *
+ * The variable diffusivity is DIFFUSIVITY_RATIO on the east half of the plate and 1 on the west
+ * half. The coefficient of a neighbor is the harmonic mean of the diffusivities of the two points,
+ * as in a finite-volume discretization, and the diagonal is the sum of the four coefficients.
+ *
+ * compute_gold_stencil is the single-threaded Gauss-Seidel reference for the same operator; the
+ * solver uses it instead of compute_gold with this method.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "trace.h"
+#include "stencil.h"
+
+#define CACHE_LINE 64
+#define DIFFUSIVITY_RATIO 10.0f
+
+/* Sweep of rows [start, end) of a grid; returns the sum of |new - old| */
+typedef double (*SWEEP_FN) (const float *, float *, size_t, int, int, int);
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_stencil_thread_t {
+    int thread_idx;
+    double diff;
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_STENCIL_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_STENCIL_THREAD) == CACHE_LINE, "ARGS_FOR_STENCIL_THREAD must fill one cache line");
+
+/* Function prototypes */
+int select_stencil (const char *);
+int compute_using_pthreads_stencil (grid_t *, int);
+int compute_gold_stencil (grid_t *);
+static double sweep_5point (const float *, float *, size_t, int, int, int);
+static double sweep_9point (const float *, float *, size_t, int, int, int);
+static double sweep_anisotropic (const float *, float *, size_t, int, int, int);
+static double sweep_variable (const float *, float *, size_t, int, int, int);
+static void build_coefficients (grid_t *);
+static void free_coefficients (void);
+static void *stencil_thread (void *);
+static void end_of_stencil_iteration (void *);
+
+extern float eps;
+extern grid_t *copy_grid (grid_t *);
+
+/* Stencils that can be selected, with their specialized sweeps */
+static const struct {
+    const STENCIL *stencil;
+    SWEEP_FN sweep;
+} stencils[] = {
+    {&stencil_5point, sweep_5point},
+    {&stencil_9point, sweep_9point},
+    {&stencil_anisotropic, sweep_anisotropic},
+    {&stencil_variable, sweep_variable},
+    {NULL, NULL}
+};
+
+/* Shared variables */
+static int stencil_choice = 0; /* Index into stencils */
+static float *coef[4]; /* Coefficient arrays of the variable stencil */
+static float *inv_diag;
+static grid_t *stencil_grid;
+static grid_t *stencil_temp;
+static ARGS_FOR_STENCIL_THREAD *stencil_args;
+static BARRIER stencil_barrier;
+static int stencil_num_threads;
+static int stencil_iter;
+static int stencil_done;
+
+/* Select the stencil with the given name. Returns 0 on success and -1 for an unknown name. */
+int
+select_stencil (const char *name)
+{
+    int i;
+
+    for (i = 0; stencils[i].stencil != NULL; i++) {
+        if (strcmp (stencils[i].stencil->name, name) == 0) {
+            stencil_choice = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int
+compute_using_pthreads_stencil (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int i;
+
+    printf ("Stencil: %s\n", stencils[stencil_choice].stencil->name);
+    build_coefficients (grid);
+    stencil_grid = grid;
+    stencil_temp = copy_grid (grid); /* Second buffer, swapped with the grid each iteration */
+    stencil_num_threads = num_threads;
+    stencil_iter = 0;
+    stencil_done = 0;
+    barrier_init (&stencil_barrier, num_threads);
+
+    if (posix_memalign ((void **) &stencil_args, CACHE_LINE, sizeof (ARGS_FOR_STENCIL_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        stencil_args[i].thread_idx = i;
+        if ((pthread_create (&thread_id[i], NULL, stencil_thread, (void *) &stencil_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    barrier_destroy (&stencil_barrier);
+    free ((void *) stencil_temp->element);
+    free ((void *) stencil_temp);
+    free ((void *) stencil_args);
+    free ((void *) thread_id);
+    free_coefficients ();
+
+    return stencil_iter;
+}
+
+/* This function solves the selected stencil with the Gauss-Seidel method using a single thread. */
+int
+compute_gold_stencil (grid_t *grid)
+{
+    SWEEP_FN sweep = stencils[stencil_choice].sweep;
+    size_t num_elements = (size_t) (grid->dim - 2) * (grid->dim - 2);
+    int num_iter = 0;
+    double diff;
+
+    build_coefficients (grid);
+    do {
+        /* Sweeping the grid in place makes each row update use the new values of the rows above it
+         * and of the points to its left. */
+        diff = sweep (grid->element, grid->element, grid->stride, grid->dim, 1, grid->dim - 1)/num_elements;
+        printf ("Iteration %d. DIFF: %f. NumEl: %zu\n", num_iter, diff, num_elements);
+        num_iter++;
+    } while (diff >= eps);
+    free_coefficients ();
+
+    return num_iter;
+}
+
+/* The row sweeps, one per stencil. */
+static double
+sweep_5point (const float *src, float *dst, size_t stride, int dim, int start, int end)
+{
+    double diff = 0.0;
+    int i;
+
+    for (i = start; i < end; i++)
+        diff += stencil_relax_row (&stencil_5point, &src[i * stride], &dst[i * stride], stride, NULL, NULL, 1, dim - 1);
+    return diff;
+}
+
+static double
+sweep_9point (const float *src, float *dst, size_t stride, int dim, int start, int end)
+{
+    double diff = 0.0;
+    int i;
+
+    for (i = start; i < end; i++)
+        diff += stencil_relax_row (&stencil_9point, &src[i * stride], &dst[i * stride], stride, NULL, NULL, 1, dim - 1);
+    return diff;
+}
+
+static double
+sweep_anisotropic (const float *src, float *dst, size_t stride, int dim, int start, int end)
+{
+    double diff = 0.0;
+    int i;
+
+    for (i = start; i < end; i++)
+        diff += stencil_relax_row (&stencil_anisotropic, &src[i * stride], &dst[i * stride], stride, NULL, NULL, 1, dim - 1);
+    return diff;
+}
+
+static double
+sweep_variable (const float *src, float *dst, size_t stride, int dim, int start, int end)
+{
+    double diff = 0.0;
+    int i;
+
+    for (i = start; i < end; i++) {
+        const float *row_coef[4] = {&coef[0][i * stride], &coef[1][i * stride], &coef[2][i * stride], &coef[3][i * stride]};
+        diff += stencil_relax_row (&stencil_variable, &src[i * stride], &dst[i * stride], stride, row_coef, &inv_diag[i * stride], 1, dim - 1);
+    }
+    return diff;
+}
+
+/* Fill in the coefficient arrays of the variable stencil for the grid, in the order of the points
+ * of its descriptor (north, south, east, west). Other stencils need none. */
+static void
+build_coefficients (grid_t *grid)
+{
+    size_t size = sizeof (float) * grid->plane;
+    int dim = grid->dim;
+    float *a;
+    int i, j, k;
+
+    if (!stencils[stencil_choice].stencil->variable)
+        return;
+
+    a = (float *) malloc (size);
+    inv_diag = (float *) malloc (size);
+    if (a == NULL || inv_diag == NULL) {
+        perror ("malloc");
+        exit (EXIT_FAILURE);
+    }
+    for (k = 0; k < 4; k++) {
+        coef[k] = (float *) malloc (size);
+        if (coef[k] == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < dim; i++)
+        for (j = 0; j < dim; j++)
+            a[i * grid->stride + j] = (j < dim/2) ? 1.0f : DIFFUSIVITY_RATIO;
+
+    for (i = 1; i < (dim - 1); i++) {
+        for (j = 1; j < (dim - 1); j++) {
+            size_t idx = i * grid->stride + j;
+            float diag = 0.0f;
+            for (k = 0; k < 4; k++) {
+                float other = a[idx + stencil_variable.di[k] * (ptrdiff_t) grid->stride + stencil_variable.dj[k]];
+                coef[k][idx] = 2.0f * a[idx] * other/(a[idx] + other);
+                diag += coef[k][idx];
+            }
+            inv_diag[idx] = 1.0f/diag;
+        }
+    }
+    free ((void *) a);
+}
+
+static void
+free_coefficients (void)
+{
+    int k;
+
+    if (!stencils[stencil_choice].stencil->variable)
+        return;
+    for (k = 0; k < 4; k++)
+        free ((void *) coef[k]);
+    free ((void *) inv_diag);
+}
+
+/* The function executed by the threads. Each thread updates a contiguous block of rows. */
+static void *
+stencil_thread (void *thread_parameter)
+{
+    ARGS_FOR_STENCIL_THREAD *parameter = (ARGS_FOR_STENCIL_THREAD *) thread_parameter;
+    SWEEP_FN sweep = stencils[stencil_choice].sweep;
+    int dim = stencil_grid->dim;
+    int num_rows = dim - 2;
+    int start = 1 + (parameter->thread_idx * num_rows)/stencil_num_threads;
+    int end = 1 + ((parameter->thread_idx + 1) * num_rows)/stencil_num_threads;
+
+    while (!stencil_done) {
+        trace_event (parameter->thread_idx, TRACE_SWEEP_BEGIN);
+        /* Buffers may only be swapped inside the barrier */
+        parameter->diff = sweep (stencil_grid->element, stencil_temp->element, stencil_grid->stride, dim, start, end);
+        trace_event (parameter->thread_idx, TRACE_SWEEP_END);
+        trace_event (parameter->thread_idx, TRACE_BARRIER_ARRIVE);
+        barrier_sync (&stencil_barrier, end_of_stencil_iteration, NULL); /* Wait here for all threads at the end of each iteration */
+        trace_event (parameter->thread_idx, TRACE_BARRIER_DEPART);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks for convergence and swaps the two buffers. */
+static void
+end_of_stencil_iteration (void *arg)
+{
+    size_t num_elements = (size_t) (stencil_grid->dim - 2) * (stencil_grid->dim - 2);
+    double diff = 0.0;
+    float *temp;
+    int i;
+
+    for (i = 0; i < stencil_num_threads; i++)
+        diff += stencil_args[i].diff;
+    diff = diff/num_elements;
+    printf ("Iteration %d. DIFF: %f.\n", stencil_iter, diff);
+    stencil_iter++;
+    if (diff < eps)
+        stencil_done = 1;
+
+    temp = stencil_grid->element;
+    stencil_grid->element = stencil_temp->element;
+    stencil_temp->element = temp;
+}
@@ -0,0 +1,285 @@
+/* Cache-blocked jacobi solver with temporal blocking.
+ *
+ * The interior of the grid is split into square tiles that are distributed cyclically over
+ * the threads. A thread loads a tile together with a halo of time_steps points into a private
+ * scratch buffer sized to stay in L2, runs time_steps jacobi iterations on it (the valid region
+ * shrinks by one point per iteration, so the halo is recomputed redundantly), and writes the
+ * center of the tile back to the output grid. The grid therefore streams through DRAM once per
+ * group of time_steps iterations instead of once per iteration.
+ *
+ * The residual of every iteration in a group is accumulated over the tile centers, so the
+ * convergence test sees exactly the per-iteration values of the plain jacobi solver. If
+ * convergence is reached part-way through a group, the group is recomputed from its input
+ * grid with fewer steps, so the solver stops at the same iteration as the untiled version.
+ *
+ * Compile with solver.c; see the compile line there. Tile size and number of steps can be
+ * changed with -D TILE_DIM=... -D TIME_STEPS=...
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "grid.h"
+#include "barrier.h"
+#include "trace.h"
+
+#ifndef TILE_DIM
+#define TILE_DIM 120 /* Two (TILE_DIM + 2 * TIME_STEPS)^2 float buffers take 128 KB, half of a 256 KB L2 */
+#endif
+
+#ifndef TIME_STEPS
+#define TIME_STEPS 4 /* Jacobi iterations per pass over the grid */
+#endif
+
+#define MAX_TIME_STEPS 16
+
+#define CACHE_LINE 64
+
+/* Structure used to pass arguments to the worker threads, aligned to a cache line */
+typedef struct args_for_tiled_thread_t {
+    int thread_idx;
+    float *scratch; /* Two buffers of (tile_dim + 2 * time_steps)^2 elements */
+    double diff[MAX_TIME_STEPS]; /* Residual of each iteration of the group over this thread's tiles */
+} __attribute__ ((aligned (CACHE_LINE))) ARGS_FOR_TILED_THREAD;
+
+_Static_assert (sizeof (ARGS_FOR_TILED_THREAD) % CACHE_LINE == 0, "ARGS_FOR_TILED_THREAD must fill whole cache lines");
+
+/* Function prototypes */
+int compute_using_pthreads_jacobi_tiled (grid_t *, int);
+static void *tiled_thread (void *);
+static void end_of_group (void *);
+static void relax_tile (const float *, float *, int, size_t, int, int, int, int, int, float *, double *);
+
+extern grid_t *copy_grid (grid_t *);
+extern float eps;
+extern int max_iter;
+
+/* Tile parameters; may be changed before calling the solver. */
+int tile_dim = TILE_DIM;
+int time_steps = TIME_STEPS;
+
+/* Shared variables */
+static grid_t *grid_in; /* Input of the current group of iterations */
+static grid_t *grid_out; /* Output of the current group of iterations */
+static ARGS_FOR_TILED_THREAD *tiled_args;
+static BARRIER tiled_barrier;
+static int tiled_num_threads;
+static int tiles_per_side;
+static int group_steps; /* Iterations performed by the current group */
+static int tiled_iter;
+static int tiled_done;
+
+int
+compute_using_pthreads_jacobi_tiled (grid_t *grid, int num_threads)
+{
+    pthread_t *thread_id = (pthread_t *) malloc (sizeof (pthread_t) * num_threads);
+    int i;
+
+    if (time_steps < 1)
+        time_steps = 1;
+    if (time_steps > MAX_TIME_STEPS)
+        time_steps = MAX_TIME_STEPS;
+    if (tile_dim < 1)
+        tile_dim = TILE_DIM;
+
+    grid_in = grid;
+    grid_out = copy_grid (grid);
+    tiled_num_threads = num_threads;
+    tiles_per_side = (grid->dim - 2 + tile_dim - 1)/tile_dim;
+    group_steps = time_steps;
+    tiled_iter = 0;
+    tiled_done = 0;
+    barrier_init (&tiled_barrier, num_threads);
+
+    int halo_dim = tile_dim + 2 * time_steps;
+    if (posix_memalign ((void **) &tiled_args, CACHE_LINE, sizeof (ARGS_FOR_TILED_THREAD) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    for (i = 0; i < num_threads; i++) {
+        tiled_args[i].thread_idx = i;
+        tiled_args[i].scratch = (float *) malloc (sizeof (float) * 2 * halo_dim * halo_dim);
+        if (tiled_args[i].scratch == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if ((pthread_create (&thread_id[i], NULL, tiled_thread, (void *) &tiled_args[i])) != 0) {
+            perror ("pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join (thread_id[i], NULL);
+
+    /* DRAM traffic per lattice update: every group reads each tile with its halo and writes
+     * the tile once, for time_steps updates of every point. The plain sweep reads and writes
+     * every point once per update. */
+    float read = (float) halo_dim * halo_dim;
+    float written = (float) tile_dim * tile_dim;
+    printf ("Tile %d x %d, %d iterations per pass: %.2f bytes per lattice update (untiled sweep: %.2f)\n",
+            tile_dim, tile_dim, time_steps, sizeof (float) * (read + written)/(written * time_steps), 2.0 * sizeof (float));
+
+    for (i = 0; i < num_threads; i++)
+        free ((void *) tiled_args[i].scratch);
+    free ((void *) tiled_args);
+    barrier_destroy (&tiled_barrier);
+    free ((void *) grid_out->element);
+    free ((void *) grid_out);
+    free ((void *) thread_id);
+
+    return tiled_iter;
+}
+
+/* The function executed by the threads. */
+static void *
+tiled_thread (void *thread_parameter)
+{
+    ARGS_FOR_TILED_THREAD *parameter = (ARGS_FOR_TILED_THREAD *) thread_parameter;
+    int dim = grid_in->dim;
+    int num_tiles = tiles_per_side * tiles_per_side;
+    int tile, t;
+
+    while (!tiled_done) {
+        trace_event (parameter->thread_idx, TRACE_SWEEP_BEGIN);
+        for (t = 0; t < group_steps; t++)
+            parameter->diff[t] = 0.0;
+
+        for (tile = parameter->thread_idx; tile < num_tiles; tile += tiled_num_threads) {
+            int r0 = 1 + (tile / tiles_per_side) * tile_dim;
+            int c0 = 1 + (tile % tiles_per_side) * tile_dim;
+            int r1 = (r0 + tile_dim < dim - 1) ? r0 + tile_dim : dim - 1;
+            int c1 = (c0 + tile_dim < dim - 1) ? c0 + tile_dim : dim - 1;
+            relax_tile (grid_in->element, grid_out->element, dim, grid_in->stride, r0, r1, c0, c1, group_steps,
+                        parameter->scratch, parameter->diff);
+        }
+
+        trace_event (parameter->thread_idx, TRACE_SWEEP_END);
+        trace_event (parameter->thread_idx, TRACE_BARRIER_ARRIVE);
+        barrier_sync (&tiled_barrier, end_of_group, NULL); /* Wait here for all threads at the end of each group */
+        trace_event (parameter->thread_idx, TRACE_BARRIER_DEPART);
+    }
+
+    pthread_exit (NULL);
+}
+
+/* Executed by the last thread to reach the barrier. Checks the residual of every iteration
+ * in the group and swaps the grids. */
+static void
+end_of_group (void *arg)
+{
+    size_t num_elements = (size_t) (grid_in->dim - 2) * (grid_in->dim - 2);
+    double diff[MAX_TIME_STEPS];
+    float *temp;
+    int i, t;
+
+    for (t = 0; t < group_steps; t++) {
+        diff[t] = 0.0;
+        for (i = 0; i < tiled_num_threads; i++)
+            diff[t] += tiled_args[i].diff[t];
+        diff[t] = diff[t]/num_elements;
+        if (diff[t] < eps)
+            break;
+    }
+
+    if (t < group_steps - 1) {
+        /* Converged inside the group. The input grid is untouched, so redo the group
+         * with just enough steps to stop at the converged iteration. */
+        group_steps = t + 1;
+        return;
+    }
+
+    for (i = 0; i < group_steps; i++)
+        printf ("Iteration %d. DIFF: %f.\n", tiled_iter + i, diff[i]);
+    tiled_iter += group_steps;
+    if (t == group_steps - 1 || (max_iter > 0 && tiled_iter >= max_iter))
+        tiled_done = 1;
+
+    temp = grid_in->element;
+    grid_in->element = grid_out->element;
+    grid_out->element = temp;
+}
+
+/* Update points [lo, hi) of one row. */
+static inline void
+relax_row (const float *row, float *out, int w, int lo, int hi)
+{
+    for (int j = lo; j < hi; j++)
+        out[j] = 0.25 * (row[j - w] + row[j + w] + row[j + 1] + row[j - 1]);
+}
+
+/* Update points [lo, hi) of one row and return the sum of the differences. */
+static inline double
+relax_row_diff (const float *row, float *out, int w, int lo, int hi)
+{
+    double diff = 0.0;
+    for (int j = lo; j < hi; j++) {
+        float new = 0.25 * (row[j - w] + row[j + w] + row[j + 1] + row[j - 1]);
+        diff += fabs (new - row[j]);
+        out[j] = new;
+    }
+    return diff;
+}
+
+/* Run steps jacobi iterations on rows [r0, r1) and columns [c0, c1) of src, a dim x dim grid with
+ * rows stride floats apart, using a halo of steps points loaded into scratch, and store the result
+ * in dst. diff[t] accumulates the residual of iteration t over the tile. */
+static void
+relax_tile (const float *src, float *dst, int dim, size_t stride, int r0, int r1, int c0, int c1, int steps,
+            float *scratch, double *diff)
+{
+    int R0 = (r0 - steps > 0) ? r0 - steps : 0;
+    int R1 = (r1 + steps < dim) ? r1 + steps : dim;
+    int C0 = (c0 - steps > 0) ? c0 - steps : 0;
+    int C1 = (c1 + steps < dim) ? c1 + steps : dim;
+    int w = C1 - C0;
+    int h = R1 - R0;
+    float *a = scratch;
+    float *b = scratch + h * w;
+    float *temp;
+    int i, t;
+
+    /* Load the tile and its halo. Both buffers need the fixed boundary values. */
+    for (i = 0; i < h; i++)
+        memcpy (&a[i * w], &src[(R0 + i) * stride + C0], sizeof (float) * w);
+    memcpy (b, a, sizeof (float) * h * w);
+
+    for (t = 1; t <= steps; t++) {
+        /* Points that are still valid after t iterations, in grid coordinates. */
+        int lo_i = (r0 - steps + t > 1) ? r0 - steps + t : 1;
+        int hi_i = (r1 + steps - t < dim - 1) ? r1 + steps - t : dim - 1;
+        int lo_j = (c0 - steps + t > 1) ? c0 - steps + t : 1;
+        int hi_j = (c1 + steps - t < dim - 1) ? c1 + steps - t : dim - 1;
+        double diff_temp = 0.0;
+
+        for (i = lo_i; i < hi_i; i++) {
+            /* Row bases in the scratch buffers; column j of the grid is at index j - C0 */
+            const float *row = &a[(i - R0) * w];
+            float *out = &b[(i - R0) * w];
+
+            if (i >= r0 && i < r1) {
+                relax_row (row, out, w, lo_j - C0, c0 - C0);
+                diff_temp += relax_row_diff (row, out, w, c0 - C0, c1 - C0);
+                relax_row (row, out, w, c1 - C0, hi_j - C0);
+            }
+            else
+                relax_row (row, out, w, lo_j - C0, hi_j - C0);
+        }
+
+        diff[t - 1] += diff_temp;
+        temp = a;
+        a = b;
+        b = temp;
+    }
+
+    /* Write back the center of the tile. */
+    for (i = r0; i < r1; i++)
+        memcpy (&dst[i * stride + c0], &a[(i - R0) * w + (c0 - C0)], sizeof (float) * (c1 - c0));
+}
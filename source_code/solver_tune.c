@@ -0,0 +1,223 @@
+/* Autotuner for the method, thread count and tile size.
+ *
+ * Beyond some number of threads, which depends on the grid dimension and the machine, the
+ * barrier costs more than the extra threads save, and the best decomposition changes with the
+ * dimension as well. The tuner times a short calibration run of every candidate on a copy of the
+ * grid: the column-cyclic jacobi method, row blocks (team), 2-D blocks (blocks), SIMD row blocks
+ * (simd), and cache tiles of each size in tile_sizes (tiled), each with 1, 2, 4, ... threads up to
+ * the num-threads given on the command line. A calibration run does calibration_iterations
+ * iterations, enough for about CALIBRATION_UPDATES grid-point updates, and the candidate with the
+ * least time per iteration wins.
+ *
+ * The winner is appended to TUNE_FILE in the current directory, keyed by the host name, the number
+ * of online processors, the grid dimension and the thread limit. Later runs with the same key use
+ * the cached configuration without calibrating; if a key appears more than once the last entry
+ * counts, so retuning just appends a new one.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "grid.h"
+
+#define TUNE_FILE ".solver_tune"
+#define CALIBRATION_UPDATES 2e7
+#define MIN_CALIBRATION_ITERATIONS 4
+#define MAX_CALIBRATION_ITERATIONS 64
+#define MAX_HOST_NAME 64
+
+/* A method the tuner can choose */
+typedef struct tune_method_t {
+    const char *name;
+    int (*solve) (grid_t *, int);
+    int tiled; /* Also tune tile_dim */
+} TUNE_METHOD;
+
+/* Function prototypes */
+void autotune (grid_t *, int, int, const char **, int *);
+static int lookup (const char *, int, int, int, const char **, int *, int *);
+static void store (const char *, int, int, int, const char *, int, int, double);
+static double calibrate (TUNE_METHOD *, grid_t *, int, int);
+
+extern int compute_using_pthreads_jacobi (grid_t *, int);
+extern int compute_using_jacobi_solver (grid_t *, int);
+extern int compute_using_pthreads_jacobi_blocks (grid_t *, int);
+extern int compute_using_pthreads_jacobi_simd (grid_t *, int);
+extern int compute_using_pthreads_jacobi_tiled (grid_t *, int);
+extern grid_t *copy_grid (grid_t *);
+extern float eps;
+extern int max_iter;
+extern int total_iter;
+extern int tile_dim;
+extern grid_t *grid_2;
+
+static TUNE_METHOD tune_methods[] = {
+    {"jacobi", compute_using_pthreads_jacobi, 0},
+    {"team", compute_using_jacobi_solver, 0},
+    {"blocks", compute_using_pthreads_jacobi_blocks, 0},
+    {"simd", compute_using_pthreads_jacobi_simd, 0},
+    {"tiled", compute_using_pthreads_jacobi_tiled, 1},
+    {NULL, NULL, 0}
+};
+
+static const int tile_sizes[] = {32, 64, 120, 248, 0};
+
+/* Choose the method and the number of threads, at most max_threads, for grid, and set tile_dim if
+ * the method is tiled. The cached choice is used unless retune is set. */
+void
+autotune (grid_t *grid, int max_threads, int retune, const char **method, int *num_threads)
+{
+    char host[MAX_HOST_NAME];
+    int cpus = (int) sysconf (_SC_NPROCESSORS_ONLN);
+    int calibration_iterations = CALIBRATION_UPDATES/GRID_INTERIOR (grid);
+    double best = 0.0, seconds;
+    int saved_tile_dim = tile_dim;
+    int best_tile = 0;
+    int m, t, s;
+
+    if (gethostname (host, sizeof (host)) != 0)
+        strcpy (host, "unknown");
+    host[sizeof (host) - 1] = '\0';
+    for (s = 0; host[s] != '\0'; s++)
+        if (host[s] == ' ')
+            host[s] = '_'; /* The cache is whitespace separated */
+
+    if (!retune && lookup (host, cpus, grid->dim, max_threads, method, num_threads, &best_tile)) {
+        if (best_tile > 0)
+            tile_dim = best_tile;
+        printf ("Autotune: %s method with %d threads", *method, *num_threads);
+        if (best_tile > 0)
+            printf (", %d x %d tiles", best_tile, best_tile);
+        printf (", from %s\n", TUNE_FILE);
+        return;
+    }
+
+    if (calibration_iterations < MIN_CALIBRATION_ITERATIONS)
+        calibration_iterations = MIN_CALIBRATION_ITERATIONS;
+    if (calibration_iterations > MAX_CALIBRATION_ITERATIONS)
+        calibration_iterations = MAX_CALIBRATION_ITERATIONS;
+    printf ("Autotune: calibrating with %d iterations per candidate\n", calibration_iterations);
+
+    for (m = 0; tune_methods[m].name != NULL; m++) {
+        for (s = 0; s == 0 || (tune_methods[m].tiled && tile_sizes[s] > 0); s++) {
+            if (tune_methods[m].tiled) {
+                if (tile_sizes[s] > grid->dim - 2 && s > 0)
+                    break; /* A single tile already covers the grid */
+                tile_dim = tile_sizes[s];
+            }
+            for (t = 1; t <= max_threads; t = (t == max_threads || 2 * t < max_threads) ? 2 * t : max_threads) {
+                seconds = calibrate (&tune_methods[m], grid, t, calibration_iterations);
+                printf ("Autotune: %s, %d threads", tune_methods[m].name, t);
+                if (tune_methods[m].tiled)
+                    printf (", %d x %d tiles", tile_dim, tile_dim);
+                printf (": %e s per iteration\n", seconds);
+                if (best == 0.0 || seconds < best) {
+                    best = seconds;
+                    *method = tune_methods[m].name;
+                    *num_threads = t;
+                    best_tile = tune_methods[m].tiled ? tile_dim : 0;
+                }
+            }
+        }
+    }
+
+    tile_dim = (best_tile > 0) ? best_tile : saved_tile_dim;
+    printf ("Autotune: best is the %s method with %d threads", *method, *num_threads);
+    if (best_tile > 0)
+        printf (", %d x %d tiles", best_tile, best_tile);
+    printf (", %e s per iteration; saved to %s\n", best, TUNE_FILE);
+    store (host, cpus, grid->dim, max_threads, *method, *num_threads, best_tile, best);
+}
+
+/* Time calibration_iterations iterations of method on a copy of grid. Returns seconds per iteration. */
+static double
+calibrate (TUNE_METHOD *method, grid_t *grid, int num_threads, int calibration_iterations)
+{
+    grid_t *copy = copy_grid (grid);
+    grid_t *saved_grid_2 = grid_2; /* The jacobi method points grid 2 at the grid it solves */
+    float saved_eps = eps;
+    struct timeval start, stop;
+    int iterations;
+
+    if (copy == NULL) {
+        perror ("copy_grid");
+        exit (EXIT_FAILURE);
+    }
+    eps = 0.0; /* Run exactly calibration_iterations iterations */
+    max_iter = calibration_iterations;
+    total_iter = 0;
+
+    gettimeofday (&start, NULL);
+    iterations = method->solve (copy, num_threads);
+    gettimeofday (&stop, NULL);
+
+    eps = saved_eps;
+    max_iter = 0;
+    total_iter = 0;
+    grid_2 = saved_grid_2;
+    free ((void *) copy->element);
+    free ((void *) copy);
+
+    return (stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/1000000.0)/(iterations > 0 ? iterations : 1);
+}
+
+/* Find the last cache entry for this host, processor count, dimension and thread limit. Returns 1
+ * and the configuration if there is one. */
+static int
+lookup (const char *host, int cpus, int dim, int max_threads, const char **method, int *num_threads, int *tile)
+{
+    FILE *file = fopen (TUNE_FILE, "r");
+    char line[256], entry_host[MAX_HOST_NAME], entry_method[16];
+    int entry_cpus, entry_dim, entry_max, entry_threads, entry_tile, m;
+    int found = 0;
+    double seconds;
+
+    if (file == NULL)
+        return 0;
+
+    while (fgets (line, sizeof (line), file) != NULL) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf (line, "%63s %d %d %d %15s %d %d %lf", entry_host, &entry_cpus, &entry_dim, &entry_max,
+                    entry_method, &entry_threads, &entry_tile, &seconds) != 8)
+            continue;
+        if (strcmp (entry_host, host) != 0 || entry_cpus != cpus || entry_dim != dim || entry_max != max_threads)
+            continue;
+        for (m = 0; tune_methods[m].name != NULL; m++)
+            if (strcmp (tune_methods[m].name, entry_method) == 0)
+                break;
+        if (tune_methods[m].name == NULL || entry_threads < 1 || entry_threads > max_threads)
+            continue; /* Written by a different version */
+        *method = tune_methods[m].name;
+        *num_threads = entry_threads;
+        *tile = entry_tile;
+        found = 1;
+    }
+
+    fclose (file);
+    return found;
+}
+
+/* Append an entry to the cache, creating it with a header line if needed. */
+static void
+store (const char *host, int cpus, int dim, int max_threads, const char *method, int num_threads, int tile, double seconds)
+{
+    int exists = (access (TUNE_FILE, F_OK) == 0);
+    FILE *file = fopen (TUNE_FILE, "a");
+
+    if (file == NULL) {
+        perror (TUNE_FILE);
+        return; /* The configuration is still used for this run */
+    }
+    if (!exists)
+        fprintf (file, "# host cpus dim max-threads method threads tile seconds-per-iteration\n");
+    fprintf (file, "%s %d %d %d %s %d %d %e\n", host, cpus, dim, max_threads, method, num_threads, tile, seconds);
+    if (fclose (file) != 0)
+        perror (TUNE_FILE);
+}
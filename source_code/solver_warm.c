@@ -0,0 +1,123 @@
+/* Warm start by grid sequencing (nested iteration).
+ *
+ * A cold start begins with an interior at zero, and the jacobi iteration moves the heat of the
+ * north edge into the plate by one row per iteration, so most of the iterations on a large plate
+ * only propagate the boundary. Here the plate is first solved on a sequence of coarser plates, each
+ * about half the dimension of the next, down to WARM_MIN_DIM. The coarsest plate starts at zero;
+ * the solution of each plate, interpolated bilinearly, is the initial guess of the next finer one,
+ * and the last one is interpolated into the interior of the target grid, which the selected method
+ * then solves as usual. The boundary of a coarse plate is the boundary of the target grid, sampled
+ * at the same positions on the unit plate, as in the multigrid solver.
+ *
+ * The coarse plates are solved by one JACOBI_SOLVER (jacobi_solver.h), to the same eps, so the
+ * thread team is created once for all of them.
+ *
+ * The test on the mean change per sweep stops a plate of dimension n with an error of about
+ * eps n^2 / pi^2, so each coarse plate ends up closer to the solution than the grid itself would
+ * when started cold, and at the default eps of 1e-2 the grid typically converges after a handful
+ * of sweeps. Its answer then differs a lot from the reference solution of compute_gold, which stops
+ * at the same eps from a cold start, while being much closer to the converged plate: on 256 x 256
+ * the MSE against compute_gold is about 1350 for the warm start and 130 for the cold one, but about
+ * 9 and 2100 against the converged plate. The comparison in solver.c therefore measures both starts
+ * against the plate converged with multigrid, and only reports the speedup when the warm start is
+ * at least as close to it as the cold start.
+ *
+ * Compile with solver.c; see the compile line there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "grid.h"
+#include "jacobi_solver.h"
+
+#define WARM_MIN_DIM 32 /* Dimension at or below which the coarsest plate is */
+
+/* Function prototypes */
+int warm_start (grid_t *, int);
+static void resample (grid_t *, grid_t *, int);
+
+extern float eps;
+extern grid_t *allocate_grid (int, int, int);
+
+/* Replace the interior of grid with an interpolated coarse solution. Returns the number of
+ * iterations spent on the coarse plates. */
+int
+warm_start (grid_t *grid, int num_threads)
+{
+    JACOBI_SOLVER *solver;
+    grid_t **levels;
+    int num_levels = 0;
+    int num_iter = 0;
+    int dim, i, iter;
+
+    for (dim = (grid->dim + 1)/2; dim >= WARM_MIN_DIM; dim = (dim + 1)/2)
+        num_levels++;
+    if (num_levels == 0)
+        return 0; /* Too small to be worth it */
+
+    /* Level 0 is the coarsest. */
+    levels = (grid_t **) malloc (sizeof (grid_t *) * num_levels);
+    for (i = num_levels - 1, dim = (grid->dim + 1)/2; i >= 0; i--, dim = (dim + 1)/2) {
+        levels[i] = allocate_grid (dim, dim, 1);
+        if (levels[i] == NULL) {
+            perror ("allocate_grid");
+            exit (EXIT_FAILURE);
+        }
+        resample (grid, levels[i], 0);
+    }
+
+    solver = jacobi_solver_create (num_threads);
+    if (solver == NULL) {
+        fprintf (stderr, "Cannot create a solver with %d threads\n", num_threads);
+        exit (EXIT_FAILURE);
+    }
+    jacobi_solver_set_tolerance (solver, eps);
+    for (i = 0; i < num_levels; i++) {
+        if (i > 0)
+            resample (levels[i - 1], levels[i], 1);
+        iter = jacobi_solver_solve (solver, levels[i]);
+        printf ("Warm start: %d x %d plate converged after %d iterations\n", levels[i]->dim, levels[i]->dim, iter);
+        num_iter += iter;
+    }
+    jacobi_solver_destroy (solver);
+    resample (levels[num_levels - 1], grid, 1);
+
+    for (i = 0; i < num_levels; i++) {
+        free ((void *) levels[i]->element);
+        free ((void *) levels[i]);
+    }
+    free ((void *) levels);
+
+    return num_iter;
+}
+
+/* Set the interior points (interior != 0) or the boundary points (interior == 0) of dst to the
+ * bilinear interpolation of src at the same positions on the unit plate. */
+static void
+resample (grid_t *src, grid_t *dst, int interior)
+{
+    double ratio = (double) (src->dim - 1)/(dst->dim - 1);
+    int i, j;
+
+    for (i = 0; i < dst->dim; i++) {
+        int boundary_row = (i == 0 || i == dst->dim - 1);
+        double y = i * ratio;
+        int i0 = (int) y;
+        if (i0 > src->dim - 2)
+            i0 = src->dim - 2; /* The last row interpolates from below with weight 1 */
+        float wy = y - i0;
+
+        for (j = 0; j < dst->dim; j++) {
+            if ((boundary_row || j == 0 || j == dst->dim - 1) == (interior != 0))
+                continue;
+            double x = j * ratio;
+            int j0 = (int) x;
+            if (j0 > src->dim - 2)
+                j0 = src->dim - 2;
+            float wx = x - j0;
+            const float *s = &src->element[i0 * src->stride + j0];
+            dst->element[i * dst->stride + j] = (1.0 - wy) * ((1.0 - wx) * s[0] + wx * s[1]) +\
+                                                wy * ((1.0 - wx) * s[src->stride] + wx * s[src->stride + 1]);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __STENCIL__
+#define __STENCIL__
+
+#include <stddef.h>
+#include <math.h>
+
+#define MAX_STENCIL_POINTS 8
+
+/* A 2-D stencil, as the jacobi update rule it induces:
+ *
+ *     u(i, j) = scale * sum over k of weight[k] * u(i + di[k], j + dj[k])
+ *
+ * With variable set, weight[k] and scale are not constants but the values at (i, j) of per-point
+ * coefficient arrays, coef[k] and inv_diag, which have the layout of the grid.
+ *
+ * The descriptors below are static constants, and stencil_relax_row is always inlined, so a call
+ * with the address of a descriptor compiles to a kernel specialized for that stencil: the loop over
+ * the points is fully unrolled, unit weights disappear, and the loop over the row is vectorized
+ * like the hand-written 5-point loops. The points are summed in the order they are listed, so the
+ * 5-point descriptor gives the same values, bit for bit, as 0.25 * (N + S + E + W). */
+typedef struct stencil_s {
+    const char *name;
+    int num_points;
+    int di[MAX_STENCIL_POINTS]; /* Row offset of each point */
+    int dj[MAX_STENCIL_POINTS]; /* Column offset of each point */
+    float weight[MAX_STENCIL_POINTS];
+    float scale;
+    int variable; /* Use coef[k] and inv_diag instead of weight[k] and scale */
+} STENCIL;
+
+#define ANISOTROPY 0.1f /* Ratio of the north-south to the east-west diffusivity */
+
+/* Laplacian, 5 points */
+static const STENCIL stencil_5point = {
+    "5point", 4,
+    {-1, 1, 0, 0},
+    {0, 0, 1, -1},
+    {1.0f, 1.0f, 1.0f, 1.0f},
+    0.25f, 0
+};
+
+/* Laplacian, 9 points, fourth order for the Laplace equation (Mehrstellen): edges weigh 4, corners 1 */
+static const STENCIL stencil_9point = {
+    "9point", 8,
+    {-1, 1, 0, 0, -1, -1, 1, 1},
+    {0, 0, 1, -1, -1, 1, -1, 1},
+    {4.0f, 4.0f, 4.0f, 4.0f, 1.0f, 1.0f, 1.0f, 1.0f},
+    0.05f, 0
+};
+
+/* Anisotropic diffusion, u_xx + ANISOTROPY * u_yy */
+static const STENCIL stencil_anisotropic = {
+    "aniso", 4,
+    {-1, 1, 0, 0},
+    {0, 0, 1, -1},
+    {ANISOTROPY, ANISOTROPY, 1.0f, 1.0f},
+    1.0f/(2.0f + 2.0f * ANISOTROPY), 0
+};
+
+/* Diffusion with a diffusivity that varies from point to point, div (a grad u) */
+static const STENCIL stencil_variable = {
+    "varcoef", 4,
+    {-1, 1, 0, 0},
+    {0, 0, 1, -1},
+    {0.0f, 0.0f, 0.0f, 0.0f},
+    0.0f, 1
+};
+
+/* Update points [lo, hi) of the row that starts at src, writing them to dst, and return the sum
+ * of |new - old|. coef and inv_diag point at the same row of the coefficient arrays, and are only
+ * read by a variable stencil. dst may be src, which gives a Gauss-Seidel sweep of the row. */
+static inline __attribute__ ((always_inline)) double
+stencil_relax_row (const STENCIL *stencil, const float *src, float *dst, size_t stride,
+                   const float *const *coef, const float *inv_diag, int lo, int hi)
+{
+    double diff = 0.0;
+    float old, new, sum;
+    int j, k;
+
+    for (j = lo; j < hi; j++) {
+        old = src[j]; /* Store old value of grid point. */
+        /* Apply the update rule. */
+        sum = 0.0f;
+#pragma GCC unroll 8
+        for (k = 0; k < stencil->num_points; k++) {
+            float u = src[(ptrdiff_t) stencil->di[k] * (ptrdiff_t) stride + j + stencil->dj[k]];
+            if (stencil->variable)
+                sum = (k == 0) ? coef[k][j] * u : sum + coef[k][j] * u;
+            else if (stencil->weight[k] == 1.0f)
+                sum = (k == 0) ? u : sum + u;
+            else
+                sum = (k == 0) ? stencil->weight[k] * u : sum + stencil->weight[k] * u;
+        }
+        new = (stencil->variable ? inv_diag[j] : stencil->scale) * sum;
+
+        dst[j] = new; /* Update the grid-point value. */
+        diff = diff + fabs (new - old); /* Calculate the difference in values. */
+    }
+
+    return diff;
+}
+
+#endif
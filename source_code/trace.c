@@ -0,0 +1,205 @@
+/* Per-thread event trace of the bulk-synchronous solvers: summary and Chrome trace export.
+ *
+ * The time stamp counter is converted to seconds with a rate measured against the monotonic clock
+ * between trace_begin and trace_report. The summary gives, per thread, the time spent in sweeps and
+ * waiting at barriers; the load imbalance, the maximum over the mean compute time; the release
+ * latency of the barrier, from the last arrival to the last departure; and the grid-point updates
+ * per second. Barrier time includes the work the last thread does inside the barrier, such as the
+ * convergence test.
+ *
+ * The Chrome trace is a JSON file of complete ("X") events, one track per thread, that can be
+ * opened with chrome://tracing or Perfetto. It covers the events still held by the rings.
+ *
+ * Compile together with the solver; see the compile line in solver.c.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "trace.h"
+
+/* Shared variables */
+TRACE_RING *trace_rings = NULL;
+static int trace_num_threads;
+static uint64_t trace_start;
+static struct timespec trace_start_wall;
+
+/* Function prototypes */
+static double release_latency (void);
+static void export_chrome_trace (const char *, double);
+
+/* Start recording events for num_threads threads. */
+void
+trace_begin (int num_threads)
+{
+    int i;
+
+    if (posix_memalign ((void **) &trace_rings, 64, sizeof (TRACE_RING) * num_threads) != 0) {
+        perror ("posix_memalign");
+        exit (EXIT_FAILURE);
+    }
+    for (i = 0; i < num_threads; i++) {
+        trace_rings[i].events = (TRACE_EVENT *) malloc (sizeof (TRACE_EVENT) * TRACE_RING_EVENTS);
+        if (trace_rings[i].events == NULL) {
+            perror ("malloc");
+            exit (EXIT_FAILURE);
+        }
+        trace_rings[i].head = 0;
+        trace_rings[i].compute = 0;
+        trace_rings[i].wait = 0;
+        trace_rings[i].sweeps = 0;
+    }
+    trace_num_threads = num_threads;
+    clock_gettime (CLOCK_MONOTONIC, &trace_start_wall);
+    trace_start = trace_clock ();
+    for (i = 0; i < num_threads; i++)
+        trace_rings[i].last = trace_start;
+}
+
+/* Stop recording, print the summary for a solve of the given number of grid-point updates, write
+ * the Chrome trace to json_path if it is not NULL, and release the rings. */
+void
+trace_report (double updates, const char *json_path)
+{
+    uint64_t stop = trace_clock ();
+    struct timespec stop_wall;
+    double seconds, rate, max_compute = 0.0, sum_compute = 0.0, sum_wait = 0.0;
+    uint64_t barriers = 0;
+    int i;
+
+    clock_gettime (CLOCK_MONOTONIC, &stop_wall);
+    seconds = (stop_wall.tv_sec - trace_start_wall.tv_sec) + (stop_wall.tv_nsec - trace_start_wall.tv_nsec)/1e9;
+    rate = (stop - trace_start)/seconds; /* Counter ticks per second */
+
+    printf ("\nTrace: %d threads over %fs, counter at %.3f GHz\n", trace_num_threads, seconds, rate/1e9);
+    printf ("Thread   sweeps   compute (s)   barrier (s)\n");
+    for (i = 0; i < trace_num_threads; i++) {
+        TRACE_RING *ring = &trace_rings[i];
+        double compute = ring->compute/rate;
+        double wait = ring->wait/rate;
+        printf ("%6d %8llu %13.6f %13.6f\n", i, (unsigned long long) ring->sweeps, compute, wait);
+        if (compute > max_compute)
+            max_compute = compute;
+        sum_compute += compute;
+        sum_wait += wait;
+        barriers += ring->sweeps;
+    }
+
+    if (barriers == 0) {
+        printf ("No events: the method is not instrumented\n");
+    }
+    else {
+        printf ("Load imbalance (max/mean compute): %f\n", max_compute/(sum_compute/trace_num_threads));
+        printf ("Barrier wait per thread and iteration: %f us, release latency: %f us\n",
+                1e6 * sum_wait/barriers, 1e6 * release_latency ()/rate);
+        printf ("Updates/s: %e\n", updates/seconds);
+        if (json_path != NULL)
+            export_chrome_trace (json_path, rate);
+    }
+
+    for (i = 0; i < trace_num_threads; i++)
+        free ((void *) trace_rings[i].events);
+    free ((void *) trace_rings);
+    trace_rings = NULL;
+}
+
+/* Mean number of cycles from the last arrival at a barrier to the last departure from it, over the
+ * barriers whose events all the rings still hold. The n-th arrival of every thread is at the same
+ * barrier, so the barriers are matched counting back from the most recent. */
+static double
+release_latency (void)
+{
+    uint64_t **arrive = (uint64_t **) malloc (sizeof (uint64_t *) * trace_num_threads);
+    uint64_t **depart = (uint64_t **) malloc (sizeof (uint64_t *) * trace_num_threads);
+    uint64_t *count = (uint64_t *) malloc (sizeof (uint64_t) * trace_num_threads);
+    uint64_t episodes = UINT64_MAX, e, n;
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < trace_num_threads; i++) {
+        TRACE_RING *ring = &trace_rings[i];
+        uint64_t first = (ring->head > TRACE_RING_EVENTS) ? ring->head - TRACE_RING_EVENTS : 0;
+        uint64_t a = 0, d = 0;
+
+        arrive[i] = (uint64_t *) malloc (sizeof (uint64_t) * TRACE_RING_EVENTS);
+        depart[i] = (uint64_t *) malloc (sizeof (uint64_t) * TRACE_RING_EVENTS);
+        for (n = first; n < ring->head; n++) {
+            TRACE_EVENT *event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+            if (event->type == TRACE_BARRIER_ARRIVE)
+                arrive[i][a++] = event->time;
+            else if (event->type == TRACE_BARRIER_DEPART && a > d)
+                depart[i][d++] = event->time; /* Skips a departure whose arrival was overwritten */
+        }
+        count[i] = d;
+        if (d < episodes)
+            episodes = d;
+    }
+
+    for (e = 1; e <= episodes; e++) {
+        uint64_t last_arrive = 0, last_depart = 0;
+        for (i = 0; i < trace_num_threads; i++) {
+            if (arrive[i][count[i] - e] > last_arrive)
+                last_arrive = arrive[i][count[i] - e];
+            if (depart[i][count[i] - e] > last_depart)
+                last_depart = depart[i][count[i] - e];
+        }
+        sum += last_depart - last_arrive;
+    }
+
+    for (i = 0; i < trace_num_threads; i++) {
+        free ((void *) arrive[i]);
+        free ((void *) depart[i]);
+    }
+    free ((void *) arrive);
+    free ((void *) depart);
+    free ((void *) count);
+
+    return (episodes > 0) ? sum/episodes : 0.0;
+}
+
+/* Write the sweeps and barrier waits held by the rings as Chrome trace events, in microseconds
+ * from the start of the trace. */
+static void
+export_chrome_trace (const char *path, double rate)
+{
+    FILE *file = fopen (path, "w");
+    const char *separator = "";
+    uint64_t n;
+    int i;
+
+    if (file == NULL) {
+        perror (path);
+        return;
+    }
+
+    fprintf (file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (i = 0; i < trace_num_threads; i++) {
+        TRACE_RING *ring = &trace_rings[i];
+        uint64_t first = (ring->head > TRACE_RING_EVENTS) ? ring->head - TRACE_RING_EVENTS : 0;
+        TRACE_EVENT *begin = NULL; /* Unmatched sweep begin or barrier arrival */
+
+        for (n = first; n < ring->head; n++) {
+            TRACE_EVENT *event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+            if (event->type == TRACE_SWEEP_BEGIN || event->type == TRACE_BARRIER_ARRIVE) {
+                begin = event;
+                continue;
+            }
+            if (begin == NULL || begin->type != event->type - 1)
+                continue;
+            fprintf (file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                     separator, (event->type == TRACE_SWEEP_END) ? "sweep" : "barrier", i,
+                     1e6 * (begin->time - trace_start)/rate, 1e6 * (event->time - begin->time)/rate);
+            separator = ",\n";
+            begin = NULL;
+        }
+    }
+    fprintf (file, "\n]}\n");
+
+    if (fclose (file) != 0)
+        perror ("fclose");
+    else
+        printf ("Chrome trace written to %s\n", path);
+}
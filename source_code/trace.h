@@ -0,0 +1,81 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <stdint.h>
+#include <time.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Per-thread event trace of the bulk-synchronous solvers. Each thread records when it starts and
+ * ends a sweep and when it arrives at and departs from the barrier, as time stamp counter readings,
+ * into its own ring of events. A ring has a single writer, its thread, and is only read after the
+ * threads are joined, so recording takes no lock and no atomic operation. Once a ring is full the
+ * oldest events are overwritten; the running totals below cover the whole solve regardless. */
+
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 65536 /* Events kept per thread, a power of two */
+#endif
+
+#define TRACE_SWEEP_BEGIN 0
+#define TRACE_SWEEP_END 1
+#define TRACE_BARRIER_ARRIVE 2
+#define TRACE_BARRIER_DEPART 3
+
+typedef struct trace_event_s {
+    uint64_t time; /* Time stamp counter */
+    int type;
+} TRACE_EVENT;
+
+/* One ring per thread, aligned to a cache line */
+typedef struct trace_ring_s {
+    TRACE_EVENT *events;
+    uint64_t head; /* Events recorded so far; the next goes to head % TRACE_RING_EVENTS */
+    uint64_t last; /* Time of the previous event */
+    uint64_t compute; /* Cycles from sweep begin to sweep end, summed */
+    uint64_t wait; /* Cycles from barrier arrival to departure, summed */
+    uint64_t sweeps;
+} __attribute__ ((aligned (64))) TRACE_RING;
+
+_Static_assert (sizeof (TRACE_RING) == 64, "TRACE_RING must fill one cache line");
+
+extern TRACE_RING *trace_rings; /* NULL unless tracing */
+
+void trace_begin (int);
+void trace_report (double, const char *);
+
+static inline uint64_t
+trace_clock (void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+    return __rdtsc ();
+#else
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Record an event of the given type for thread (0 to num_threads - 1). Does nothing unless tracing. */
+static inline void
+trace_event (int thread, int type)
+{
+    if (trace_rings != NULL) {
+        TRACE_RING *ring = &trace_rings[thread];
+        uint64_t now = trace_clock ();
+        TRACE_EVENT *event = &ring->events[ring->head & (TRACE_RING_EVENTS - 1)];
+
+        event->time = now;
+        event->type = type;
+        if (type == TRACE_SWEEP_END) {
+            ring->compute += now - ring->last;
+            ring->sweeps++;
+        }
+        else if (type == TRACE_BARRIER_DEPART)
+            ring->wait += now - ring->last;
+        ring->last = now;
+        ring->head++;
+    }
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __TRANSPORT__
+#define __TRANSPORT__
+
+/* Communication between the processes of a multi-process solve. Each process (rank) owns a strip
+ * of rows and, once per iteration, posts its first and last rows, takes part in a global sum of
+ * the residual, and collects the rows of its neighbors. A backend fills in the operations; the
+ * solver only uses this interface, so a backend for another transport (for instance MPI, with
+ * MPI_Isend/MPI_Irecv, MPI_Allreduce, MPI_Waitall and MPI_Gatherv) can be added without touching it.
+ *
+ * Per iteration:
+ *     post_halos (t, first_row, last_row)    rank's own boundary rows, dim floats each
+ *     sum = allreduce_sum (t, local_sum)     identical on every rank, summed in rank order
+ *     wait_halos (t, row_above, row_below)   neighbors' rows posted in the same iteration;
+ *                                            a NULL row means there is no neighbor on that side
+ * After convergence, gather (t, rows, first, num_rows) assembles the strips at rank 0's grid. */
+typedef struct transport_s TRANSPORT;
+
+typedef struct transport_ops_s {
+    void (*post_halos) (TRANSPORT *, const float *, const float *);
+    double (*allreduce_sum) (TRANSPORT *, double);
+    void (*wait_halos) (TRANSPORT *, float *, float *);
+    void (*gather) (TRANSPORT *, const float *, int, int);
+} TRANSPORT_OPS;
+
+struct transport_s {
+    const TRANSPORT_OPS *ops;
+    int rank;
+    int size; /* Number of ranks */
+    int dim; /* Length of a row */
+    void *state; /* Backend data */
+};
+
+/* POSIX shared memory backend for processes on one host, created before the processes are forked.
+ * Signaling uses process-shared futexes. */
+TRANSPORT *shm_transport_create (int, int);
+void shm_transport_set_rank (TRANSPORT *, int);
+float *shm_transport_result (TRANSPORT *);
+void shm_transport_destroy (TRANSPORT *);
+
+#endif
@@ -0,0 +1,213 @@
+/* Shared-memory transport for multi-process solves on one host.
+ *
+ * The parent creates one POSIX shared memory segment before it forks the ranks. The segment holds,
+ * for every rank, a control block on its own cache line (a step counter, a count of waiting
+ * processes, and the rank's partial sum for the last two steps) and two pairs of halo rows, one
+ * pair per parity of the step; then a dim x dim grid in which gather assembles the result.
+ *
+ * allreduce_sum publishes a rank's partial sum and advances its step counter, which also publishes
+ * the halo rows posted before it, and then waits until every rank has reached the same step. A
+ * waiting process spins briefly and then sleeps on the counter with FUTEX_WAIT; the futexes are
+ * not private, so they work across processes. A rank that advances its counter only issues
+ * FUTEX_WAKE if another process has registered as waiting on it. Buffers indexed by the parity of
+ * the step can be rewritten two steps later, by which time every rank has passed the allreduce of
+ * the step in between and is done reading them.
+ *
+ * Compile together with the solver; see the compile line in solver.c.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "transport.h"
+
+#define CACHE_LINE 64
+#define SPIN_COUNT 1000 /* Polls of a step counter before sleeping on it */
+
+/* Control block of one rank, on its own cache line */
+typedef struct rank_control_s {
+    uint32_t step; /* Number of completed allreduce calls */
+    uint32_t waiters; /* Processes sleeping on step */
+    double partial[2]; /* Partial sum of step s in partial[s & 1] */
+} __attribute__ ((aligned (CACHE_LINE))) RANK_CONTROL;
+
+_Static_assert (sizeof (RANK_CONTROL) == CACHE_LINE, "RANK_CONTROL must fill one cache line");
+
+/* Private state of the backend in each process */
+typedef struct shm_state_s {
+    char name[64];
+    char *map;
+    size_t map_size;
+    RANK_CONTROL *control; /* One per rank */
+    float *halos; /* Rank r, parity p, row k (0 first, 1 last) at halos[((r * 2 + p) * 2 + k) * dim] */
+    float *result; /* dim x dim grid assembled by gather */
+    uint32_t step; /* Steps completed by this rank */
+} SHM_STATE;
+
+/* Function prototypes */
+static void shm_post_halos (TRANSPORT *, const float *, const float *);
+static double shm_allreduce_sum (TRANSPORT *, double);
+static void shm_wait_halos (TRANSPORT *, float *, float *);
+static void shm_gather (TRANSPORT *, const float *, int, int);
+static void wait_for_step (RANK_CONTROL *, uint32_t);
+static float *halo_row (TRANSPORT *, int, uint32_t, int);
+
+static const TRANSPORT_OPS shm_ops = {
+    shm_post_halos,
+    shm_allreduce_sum,
+    shm_wait_halos,
+    shm_gather
+};
+
+/* Create the shared segment for size ranks exchanging rows of dim floats. Call before forking. */
+TRANSPORT *
+shm_transport_create (int size, int dim)
+{
+    TRANSPORT *transport = (TRANSPORT *) malloc (sizeof (TRANSPORT));
+    SHM_STATE *state = (SHM_STATE *) malloc (sizeof (SHM_STATE));
+    size_t control_size = sizeof (RANK_CONTROL) * size;
+    size_t halo_size = sizeof (float) * 4 * (size_t) size * dim;
+    int fd;
+
+    snprintf (state->name, sizeof (state->name), "/jacobi-%d", (int) getpid ());
+    state->map_size = control_size + halo_size + sizeof (float) * (size_t) dim * dim;
+    fd = shm_open (state->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate (fd, state->map_size) < 0) {
+        perror ("shm_open");
+        exit (EXIT_FAILURE);
+    }
+    state->map = (char *) mmap (NULL, state->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (state->map == MAP_FAILED) {
+        perror ("mmap");
+        exit (EXIT_FAILURE);
+    }
+    close (fd);
+
+    memset (state->map, 0, control_size); /* The segment starts out zeroed, but be explicit */
+    state->control = (RANK_CONTROL *) state->map;
+    state->halos = (float *) (state->map + control_size);
+    state->result = (float *) (state->map + control_size + halo_size);
+    state->step = 0;
+
+    transport->ops = &shm_ops;
+    transport->rank = 0;
+    transport->size = size;
+    transport->dim = dim;
+    transport->state = state;
+    return transport;
+}
+
+/* Set the rank of the calling process, after the fork. */
+void
+shm_transport_set_rank (TRANSPORT *transport, int rank)
+{
+    transport->rank = rank;
+}
+
+/* The grid assembled by gather, valid in the parent once every rank has exited. */
+float *
+shm_transport_result (TRANSPORT *transport)
+{
+    return ((SHM_STATE *) transport->state)->result;
+}
+
+/* Unmap and remove the segment. */
+void
+shm_transport_destroy (TRANSPORT *transport)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+
+    munmap (state->map, state->map_size);
+    shm_unlink (state->name);
+    free ((void *) state);
+    free ((void *) transport);
+}
+
+static void
+shm_post_halos (TRANSPORT *transport, const float *first, const float *last)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+
+    memcpy (halo_row (transport, transport->rank, state->step, 0), first, sizeof (float) * transport->dim);
+    memcpy (halo_row (transport, transport->rank, state->step, 1), last, sizeof (float) * transport->dim);
+}
+
+static double
+shm_allreduce_sum (TRANSPORT *transport, double value)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+    RANK_CONTROL *mine = &state->control[transport->rank];
+    uint32_t step = state->step;
+    double sum = 0.0;
+    int r;
+
+    mine->partial[step & 1] = value;
+    __atomic_store_n (&mine->step, step + 1, __ATOMIC_SEQ_CST); /* Publishes the partial sum and the halos */
+    if (__atomic_load_n (&mine->waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall (SYS_futex, &mine->step, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    state->step = step + 1;
+
+    for (r = 0; r < transport->size; r++) {
+        wait_for_step (&state->control[r], step + 1);
+        sum += state->control[r].partial[step & 1]; /* Same order on every rank */
+    }
+    return sum;
+}
+
+static void
+shm_wait_halos (TRANSPORT *transport, float *above, float *below)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+    uint32_t step = state->step - 1; /* Step in which the rows were posted */
+
+    if (above != NULL) {
+        wait_for_step (&state->control[transport->rank - 1], step + 1);
+        memcpy (above, halo_row (transport, transport->rank - 1, step, 1), sizeof (float) * transport->dim);
+    }
+    if (below != NULL) {
+        wait_for_step (&state->control[transport->rank + 1], step + 1);
+        memcpy (below, halo_row (transport, transport->rank + 1, step, 0), sizeof (float) * transport->dim);
+    }
+}
+
+static void
+shm_gather (TRANSPORT *transport, const float *rows, int first, int num_rows)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+
+    memcpy (&state->result[(size_t) first * transport->dim], rows, sizeof (float) * (size_t) num_rows * transport->dim);
+}
+
+/* Wait until a rank has completed the given number of steps. */
+static void
+wait_for_step (RANK_CONTROL *control, uint32_t target)
+{
+    uint32_t step;
+    int spin;
+
+    for (spin = 0; spin < SPIN_COUNT; spin++)
+        if (__atomic_load_n (&control->step, __ATOMIC_ACQUIRE) >= target)
+            return;
+
+    __atomic_fetch_add (&control->waiters, 1, __ATOMIC_SEQ_CST);
+    while ((step = __atomic_load_n (&control->step, __ATOMIC_SEQ_CST)) < target)
+        syscall (SYS_futex, &control->step, FUTEX_WAIT, step, NULL, NULL, 0);
+    __atomic_fetch_sub (&control->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+static float *
+halo_row (TRANSPORT *transport, int rank, uint32_t step, int which)
+{
+    SHM_STATE *state = (SHM_STATE *) transport->state;
+
+    return &state->halos[((size_t) (rank * 2 + (step & 1)) * 2 + which) * transport->dim];
+}